@@ -1,6 +1,7 @@
 ﻿#define NODEBUG
+#include <algorithm>
 #include <iostream>
-#include "D:/Work/nuke-practice/nuke-deps/include/eigen-3.3.7/Eigen/SVD"
+#include "D:/Work/nuke-practice/nuke-deps/include/eigen-3.3.7/Eigen/Eigenvalues"
 #include "pca.h"
 
 using namespace std;
@@ -11,60 +12,121 @@ bool sortinrev(const pair<float, int> &a, const pair<float, int> &b)
 	return (a.first > b.first);
 }
 
+namespace {
+	// Columns processed between two polls of PcaControl::cancelled.
+	const unsigned int block_cols = 16384;
+}
+
 int Pca::Calculate(vector<float> &x,
 	const unsigned int &nrows,
-	const unsigned int &ncols)
+	const unsigned int &ncols,
+	const PcaControl &control)
+{
+	return Solve(x, nrows, ncols, control, nullptr);
+}
+
+int Pca::CalculateSampled(vector<float> &x,
+	const unsigned int &nrows,
+	const unsigned int &ncols,
+	const vector<unsigned int> &sample_cols,
+	const PcaControl &control)
+{
+	for (auto col : sample_cols) {
+		if (col >= ncols) {
+			return -1;
+		}
+	}
+	return Solve(x, nrows, ncols, control, &sample_cols);
+}
+
+int Pca::Solve(vector<float> &x,
+	const unsigned int &nrows,
+	const unsigned int &ncols,
+	const PcaControl &control,
+	const vector<unsigned int>* sample_cols)
 {
 	_ncols = ncols;
 	_nrows = nrows;
 	if (x.size() != _nrows*_ncols) {
 		return -1;
 	}
-	if ((1 == _ncols) || (1 == nrows)) {
+	// an empty object or a single input has nothing to decompose
+	if ((_ncols < 2) || (_nrows < 2)) {
 		return -1;
 	}
-	// Convert vector to Eigen 2-dimensional matrix
-	//Map<MatrixXf> _xXf(x.data(), _nrows, _ncols);
-	_xXf.resize(_nrows, _ncols);
-	for (unsigned int i = 0; i < _nrows; ++i) {
-		for (unsigned int j = 0; j < _ncols; ++j) {
-			_xXf(i, j) = x[j + i*_ncols];
-		}
-	}
-	// Mean and standard deviation for each column
-	VectorXf mean_vector = _xXf.colwise().mean();
-#ifdef DEBUG
-	cout << "Matrix:" << endl << _xXf << endl;
-	cout << "Mean:" << endl << mean_vector << endl;
-#endif
+	pca_vecs.clear();
+	mean_vec.clear();
+	pca_vars.clear();
+	var_props.clear();
 
-	for (int i = 0; i < _ncols; i++)
-	{
-		mean_vec.push_back(mean_vector(i, 0));
-	}
+	// The data is walked three times in column blocks: centering, building
+	// the small nrows x nrows Gram matrix and projecting onto its
+	// eigenvectors. The control is polled and notified between blocks.
+	const unsigned int blocks_n = (_ncols + block_cols - 1) / block_cols;
+	const unsigned int gram_cols = sample_cols ? static_cast<unsigned int>(sample_cols->size()) : _ncols;
+	const unsigned int gram_blocks_n = (gram_cols + block_cols - 1) / block_cols;
+	const float steps_n = 2.0f * blocks_n + gram_blocks_n;
+	auto cancelled = [&control]() {
+		return control.cancelled && control.cancelled();
+	};
+	auto report = [&control, steps_n](unsigned int step) {
+		if (control.progress)
+			control.progress(step / steps_n);
+	};
 
-	for (unsigned int i = 0; i < _ncols; ++i) {
-		_xXf.col(i) -= VectorXf::Constant(_nrows, mean_vector(i));
+	// Convert vector to Eigen 2-dimensional matrix, subtracting column means
+	Map<const Matrix<float, Dynamic, Dynamic, RowMajor>> x_rows(x.data(), _nrows, _ncols);
+	_xXf.resize(_nrows, _ncols);
+	mean_vec.resize(_ncols);
+	for (unsigned int b = 0; b < blocks_n; b++) {
+		if (cancelled())
+			return -2;
+		const unsigned int c0 = b * block_cols;
+		const unsigned int w = min(block_cols, _ncols - c0);
+		auto block = _xXf.middleCols(c0, w);
+		block = x_rows.middleCols(c0, w);
+		RowVectorXf block_mean = block.colwise().mean();
+		block.rowwise() -= block_mean;
+		std::copy(block_mean.data(), block_mean.data() + w, mean_vec.begin() + c0);
+		report(b + 1);
 	}
 	float denom = static_cast<float>((_nrows > 1) ? _nrows - 1 : 1);
 
-	JacobiSVD<MatrixXf> svd(_xXf, ComputeThinV);
-	VectorXf eigen_singular_values = svd.singularValues();
-	VectorXf eigen_values = eigen_singular_values.array().square();
-	
-	for (unsigned int i = 0; i < eigen_values.size(); ++i) {
-		pca_vars.push_back(eigen_values(i)/denom);
+	// Eigenvalues of X*X^T are the squared singular values of X
+	MatrixXd gram = MatrixXd::Zero(_nrows, _nrows);
+	for (unsigned int b = 0; b < gram_blocks_n; b++) {
+		if (cancelled())
+			return -2;
+		const unsigned int c0 = b * block_cols;
+		const unsigned int w = min(block_cols, gram_cols - c0);
+		MatrixXd block(_nrows, w);
+		if (sample_cols) {
+			for (unsigned int j = 0; j < w; j++) {
+				block.col(j) = _xXf.col((*sample_cols)[c0 + j]).cast<double>();
+			}
+		}
+		else {
+			block = _xXf.middleCols(c0, w).cast<double>();
+		}
+		gram.noalias() += block * block.transpose();
+		report(blocks_n + b + 1);
+	}
+
+	SelfAdjointEigenSolver<MatrixXd> eigen_solver(gram);
+	if (eigen_solver.info() != Success) {
+		return -1;
 	}
+	VectorXd eigen_values = eigen_solver.eigenvalues().cwiseMax(0.0);
+	const unsigned int pca_n = min(_nrows, _ncols);
 
 	vector<pair<float, int>> ep;
 	for (unsigned int i = 0; i < eigen_values.size(); ++i) {
-		ep.push_back(make_pair(pca_vars[i], i));
+		ep.push_back(make_pair(static_cast<float>(eigen_values(i) / denom), i));
 	}
 
 	sort(ep.begin(), ep.end(), sortinrev); // Sort in descending order
-	
-	pca_vars.clear();
-	for (unsigned int i = 0; i < eigen_values.size(); ++i) {
+
+	for (unsigned int i = 0; i < pca_n; ++i) {
 		pca_vars.push_back(ep[i].first);
 	}
 
@@ -72,35 +134,77 @@ int Pca::Calculate(vector<float> &x,
 	for (auto& var : pca_vars)
 		sum_var += var;
 	// proportions of variance
-	for (unsigned int i = 0; i < eigen_values.size(); ++i) {
-		var_props.push_back(pca_vars[i] / sum_var);
+	for (unsigned int i = 0; i < pca_n; ++i) {
+		var_props.push_back(sum_var > 0 ? pca_vars[i] / sum_var : 0);
 	}
-	MatrixXf eigen_vectors = svd.matrixV();
-	auto eig_rows = eigen_vectors.rows();
-	auto eig_cols = eigen_vectors.cols();
-	// V is transposed
-	pca_rows = eig_cols;
-	pca_cols = eig_rows;
-	// sort eigenvectors
-	MatrixXf eigen_vectors_sorted(eig_rows, eig_cols);
-	for (unsigned int i = 0; i < eigen_values.size(); i++) {
-		int col_id = ep[i].second;
-		eigen_vectors_sorted.col(i) = eigen_vectors.col(col_id);
+	pca_rows = pca_n;
+	pca_cols = _ncols;
+
+	// Right singular vectors: v_i = X^T * u_i / sigma_i. Directions without
+	// variance are left as zero vectors.
+	const double sigma_eps = sqrt(eigen_values.maxCoeff()) * 1e-6;
+	MatrixXf projection = MatrixXf::Zero(_nrows, pca_n);
+	for (unsigned int i = 0; i < pca_n; i++) {
+		const double sigma = sqrt(eigen_values(ep[i].second));
+		if (sigma > sigma_eps) {
+			// sampled sigmas do not describe the full columns, the projected
+			// vectors are normalized after the pass instead
+			projection.col(i) = (eigen_solver.eigenvectors().col(ep[i].second) / (sample_cols ? 1.0 : sigma)).cast<float>();
+		}
 	}
-	
-	for (int i = 0; i < eig_cols; i++)
-	{
-		std::vector<float> pca_row;
-		for (int j = 0; j < eig_rows; j++)
-		{
-			pca_row.push_back(eigen_vectors_sorted(j, i));
+
+	pca_vecs.assign(pca_n, std::vector<float>(_ncols));
+	VectorXd squared_norms = VectorXd::Zero(pca_n);
+	for (unsigned int b = 0; b < blocks_n; b++) {
+		if (cancelled())
+			return -2;
+		const unsigned int c0 = b * block_cols;
+		const unsigned int w = min(block_cols, _ncols - c0);
+		MatrixXf components = projection.transpose() * _xXf.middleCols(c0, w);
+		squared_norms += components.rowwise().squaredNorm().cast<double>();
+		for (unsigned int i = 0; i < pca_n; i++) {
+			for (unsigned int j = 0; j < w; j++) {
+				pca_vecs[i][c0 + j] = components(i, j);
+			}
+		}
+		report(blocks_n + gram_blocks_n + b + 1);
+	}
+
+	if (sample_cols) {
+		// |X^T * u_i| is the full data sigma along the sampled direction u_i
+		sum_var = 0;
+		for (unsigned int i = 0; i < pca_n; i++) {
+			const double sigma = sqrt(squared_norms(i));
+			const float scale = sigma > sigma_eps ? static_cast<float>(1.0 / sigma) : 0.0f;
+			for (auto& value : pca_vecs[i])
+				value *= scale;
+			pca_vars[i] = static_cast<float>(squared_norms(i) / denom);
+			sum_var += pca_vars[i];
+		}
+		// the full data variances need not keep the order of the sampled
+		// ones, sort the components again so they stay descending
+		vector<pair<float, int>> order;
+		for (unsigned int i = 0; i < pca_n; ++i) {
+			order.push_back(make_pair(pca_vars[i], i));
+		}
+		stable_sort(order.begin(), order.end(), sortinrev);
+		vector<vector<float>> sorted_vecs(pca_n);
+		for (unsigned int i = 0; i < pca_n; ++i) {
+			pca_vars[i] = order[i].first;
+			sorted_vecs[i].swap(pca_vecs[order[i].second]);
+		}
+		pca_vecs.swap(sorted_vecs);
+		for (unsigned int i = 0; i < pca_n; ++i) {
+			var_props[i] = sum_var > 0 ? pca_vars[i] / sum_var : 0;
 		}
-		pca_vecs.push_back(pca_row);
 	}
 
 #ifdef DEBUG
 	cout << "Eigen values: " << endl << eigen_values << endl;
-	cout << "Eigen vectors:" << endl << svd.matrixV() << endl;
+	cout << "Pca variances:" << endl;
+	for (auto& var : pca_vars)
+		cout << var << " ";
+	cout << endl;
 #endif
 	
 	return 0;
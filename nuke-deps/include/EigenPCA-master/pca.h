@@ -1,9 +1,18 @@
 #ifndef PCA_H_
 #define PCA_H_
 
+#include <functional>
 #include <vector>
 #include "D:/Work/nuke-practice/nuke-deps/include/eigen-3.3.7/Eigen/Dense"
 
+//! Hooks for following and interrupting a long Pca::Calculate
+struct PcaControl {
+	//! polled between column blocks, returning true stops the solve
+	std::function<bool()> cancelled;
+	//! receives the fraction of the solve done so far, in [0, 1]
+	std::function<void(float)> progress;
+};
+
 class Pca {
 private:
 	std::vector<float>  _x;   // Initial matrix as vector filled by rows.
@@ -19,6 +28,9 @@ private:
 	int pca_rows;
 	int pca_cols;
 
+	int Solve(std::vector<float>& x, const unsigned int& nrows, const unsigned int& ncols,
+		const PcaControl& control, const std::vector<unsigned int>* sample_cols);
+
 public:
 	//! Initializing values and performing PCA
 	/*!
@@ -26,11 +38,28 @@ public:
 	\param  x     Initial data matrix
 	\param  nrows Number of matrix rows
 	\param  ncols Number of matrix cols
+	\param  control Optional cancellation and progress hooks
 	\result
 	0 if everything is Ok
 	-1 if there were some errors
+	-2 if the solve was cancelled, results are not valid then
+	*/
+	int Calculate(std::vector<float>& x, const unsigned int& nrows, const unsigned int& ncols,
+		const PcaControl& control = PcaControl());
+	//! Performing PCA with directions estimated from a subset of columns
+	/*!
+	Row weights are found from the sampled columns only and then projected
+	back onto all columns, so components, mean and variances still cover
+	the whole matrix. Much cheaper than Calculate for wide matrices.
+	\param  x     Initial data matrix
+	\param  nrows Number of matrix rows
+	\param  ncols Number of matrix cols
+	\param  sample_cols Indices of the columns used to estimate directions
+	\param  control Optional cancellation and progress hooks
+	\result Same as Calculate
 	*/
-	int Calculate(std::vector<float>& x, const unsigned int& nrows, const unsigned int& ncols);
+	int CalculateSampled(std::vector<float>& x, const unsigned int& nrows, const unsigned int& ncols,
+		const std::vector<unsigned int>& sample_cols, const PcaControl& control = PcaControl());
 	//! Return number of rows in initial matrix
 	/*!
 	\result Number of rows in initial matrix
@@ -58,7 +87,7 @@ public:
 	std::vector<float> var_proportions();
 
     //! return extreme points of pca components
-    std::vector<std::vector<float>> Pca::calculate_extreme_points(int pca_n);
+    std::vector<std::vector<float>> calculate_extreme_points(int pca_n);
 	
 	//! Class constructor
 	Pca(void);
@@ -0,0 +1,58 @@
+#pragma once
+
+// Runtime check of the x86 vector extensions the point kernels pick their
+// code path by. CPU_FEATURES_X86 is defined when compiling for x86, the
+// kernels mark their vector functions with the target attributes below.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_FEATURES_X86
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles intrinsics of any extension without target attributes
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX512
+#else
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// Cpu_AVX2 stands for AVX2 with FMA, Cpu_AVX512 for AVX-512F on top. A
+// level only counts when the OS also saves the wider registers.
+enum CpuLevel { Cpu_Baseline, Cpu_AVX2, Cpu_AVX512 };
+
+inline CpuLevel cpu_level()
+{
+#ifdef _MSC_VER
+	// xgetbv bits the OS sets when it saves the ymm and zmm registers
+	const unsigned long long ymm_state = 0x6;
+	const unsigned long long zmm_state = 0xe6;
+
+	int info[4];
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	if (!osxsave || !avx || !fma)
+		return Cpu_Baseline;
+	const unsigned long long state = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	const bool avx2 = (info[1] & (1 << 5)) != 0;
+	const bool avx512f = (info[1] & (1 << 16)) != 0;
+	if (avx2 && avx512f && (state & zmm_state) == zmm_state)
+		return Cpu_AVX512;
+	if (avx2 && (state & ymm_state) == ymm_state)
+		return Cpu_AVX2;
+	return Cpu_Baseline;
+#else
+	// the builtins already include the OS register state
+	if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma"))
+		return Cpu_Baseline;
+	if (__builtin_cpu_supports("avx512f"))
+		return Cpu_AVX512;
+	return Cpu_AVX2;
+#endif
+}
+
+#endif
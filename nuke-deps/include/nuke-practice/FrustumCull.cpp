@@ -0,0 +1,98 @@
+#include "FrustumCull.hpp"
+#include "Morton.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+void build_clusters(const float* points, unsigned points_n, PointClusters& clusters)
+{
+	clusters.order.resize(points_n);
+	if (points_n == 0)
+		return;
+
+	float lo[3] = { points[0], points[1], points[2] };
+	float hi[3] = { points[0], points[1], points[2] };
+	for (unsigned j = 1; j < points_n; j++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			lo[axis] = std::min(lo[axis], points[3 * j + axis]);
+			hi[axis] = std::max(hi[axis], points[3 * j + axis]);
+		}
+	}
+
+	// 10 bits per axis on the object bounds
+	std::vector<std::pair<uint32_t, unsigned>> codes(points_n);
+	for (unsigned j = 0; j < points_n; j++)
+	{
+		uint32_t code = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float extent = hi[axis] - lo[axis];
+			const float t = extent > 0 ? (points[3 * j + axis] - lo[axis]) / extent : 0.0f;
+			code |= spread_bits(static_cast<uint32_t>(t * 1023.0f)) << axis;
+		}
+		codes[j] = std::make_pair(code, j);
+	}
+	std::sort(codes.begin(), codes.end());
+	for (unsigned j = 0; j < points_n; j++)
+		clusters.order[j] = codes[j].second;
+}
+
+void cluster_bounds(const PointClusters& clusters, const float* points, std::vector<float>& bounds)
+{
+	const size_t clusters_n = clusters.clusters();
+	bounds.resize(6 * clusters_n);
+	for (size_t c = 0; c < clusters_n; c++)
+	{
+		const size_t k0 = c * PointClusters::cluster_size;
+		const size_t k1 = std::min(clusters.order.size(), k0 + PointClusters::cluster_size);
+		float* box = &bounds[6 * c];
+		const float* first = points + 3 * size_t(clusters.order[k0]);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			box[axis] = first[axis];
+			box[axis + 3] = first[axis];
+		}
+		for (size_t k = k0 + 1; k < k1; k++)
+		{
+			const float* p = points + 3 * size_t(clusters.order[k]);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				box[axis] = std::min(box[axis], p[axis]);
+				box[axis + 3] = std::max(box[axis + 3], p[axis]);
+			}
+		}
+	}
+}
+
+Frustum frustum_from_matrix(const float* clip)
+{
+	// row r of the matrix, clip is column-major
+	auto row = [clip](int r, int c) { return clip[4 * c + r]; };
+
+	Frustum frustum;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			frustum.planes[2 * axis][c] = row(3, c) + row(axis, c);
+			frustum.planes[2 * axis + 1][c] = row(3, c) - row(axis, c);
+		}
+	}
+	return frustum;
+}
+
+bool box_visible(const Frustum& frustum, const float* bounds)
+{
+	for (const float* plane : frustum.planes)
+	{
+		// the box corner furthest along the plane normal
+		const float x = plane[0] >= 0 ? bounds[3] : bounds[0];
+		const float y = plane[1] >= 0 ? bounds[4] : bounds[1];
+		const float z = plane[2] >= 0 ? bounds[5] : bounds[2];
+		if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0)
+			return false;
+	}
+	return true;
+}
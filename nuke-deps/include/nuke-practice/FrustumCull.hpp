@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Points of one object sorted along a Morton curve and cut into runs of
+// cluster_size, so that every cluster covers a compact part of space.
+struct PointClusters
+{
+	static const unsigned cluster_size = 256;
+
+	std::vector<unsigned> order;
+
+	size_t clusters() const { return (order.size() + cluster_size - 1) / cluster_size; }
+};
+
+void build_clusters(const float* points, unsigned points_n, PointClusters& clusters);
+
+// Bounds of every cluster over the given flat xyz points, which may be any
+// point list of the same size as the clustered one. Six floats per cluster:
+// min x, y, z and max x, y, z.
+void cluster_bounds(const PointClusters& clusters, const float* points, std::vector<float>& bounds);
+
+// The six planes a*x + b*y + c*z + d >= 0 bounding the view volume of a
+// column-major object to clip space matrix (Gribb and Hartmann).
+struct Frustum
+{
+	float planes[6][4];
+};
+
+Frustum frustum_from_matrix(const float* clip);
+
+// False only if the box (min xyz, max xyz) lies fully outside one plane,
+// so a box reported visible may still be just outside a corner.
+bool box_visible(const Frustum& frustum, const float* bounds);
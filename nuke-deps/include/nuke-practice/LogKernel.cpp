@@ -0,0 +1,546 @@
+#include "LogKernel.hpp"
+
+#include "CpuFeatures.hpp"
+
+#include <cmath>
+
+#if defined(CPU_FEATURES_X86) && (defined(_M_X64) || defined(__x86_64__))
+#define LOG_X86
+#endif
+
+namespace {
+  typedef void (*LogFunction)(float*, size_t, size_t, const float*);
+  typedef void (*PowFunction)(float*, size_t, size_t, const float*, bool);
+  typedef void (*MapFunction)(float*, size_t);
+  typedef void (*PowValuesFunction)(float*, const float*, float, size_t);
+
+  // Constant of every float of three vectors of n lanes in xyz order
+  struct AxisPattern
+  {
+    float values[3][16];
+
+    AxisPattern(const float axis[3], int lanes)
+    {
+      for (int v = 0; v < 3; v++)
+        for (int l = 0; l < lanes; l++)
+          values[v][l] = axis[(v * lanes + l) % 3];
+    }
+  };
+
+  void log_scalar(float* points, size_t begin, size_t end, const float base[3])
+  {
+    for (size_t i = begin; i < end; i++) {
+      float* v = points + 3 * i;
+      v[0] = std::pow(base[0], v[0]) - 1.0f;
+      v[1] = std::pow(base[1], v[1]) - 1.0f;
+      v[2] = std::pow(base[2], v[2]) - 1.0f;
+    }
+  }
+
+  void pow_scalar(float* points, size_t begin, size_t end, const float exponent[3], bool clamp_black)
+  {
+    for (size_t k = 3 * begin; k < 3 * end; k++) {
+      const float e = exponent[k % 3];
+      float& v = points[k];
+      if (clamp_black)
+        v = v <= 0.0f ? 0.0f : std::pow(v, e);
+      else
+        v = v > 0.0f ? std::pow(v, e) : -std::pow(-v, e);
+    }
+  }
+
+  void exp_values_scalar(float* v, size_t n)
+  {
+    for (size_t k = 0; k < n; k++)
+      v[k] = std::exp(v[k]);
+  }
+
+  void log_values_scalar(float* v, size_t n)
+  {
+    for (size_t k = 0; k < n; k++)
+      v[k] = std::log(v[k]);
+  }
+
+  void pow_values_scalar(float* a, const float* b, float s, size_t n)
+  {
+    if (b)
+      for (size_t k = 0; k < n; k++)
+        a[k] = std::pow(a[k], b[k]);
+    else
+      for (size_t k = 0; k < n; k++)
+        a[k] = std::pow(a[k], s);
+  }
+
+  // ln(base) split in a float and the float of what it misses, so that
+  // v * ln(base) keeps about 48 bits and large arguments stay accurate
+  void split_log(const float base[3], float ln_hi[3], float ln_lo[3])
+  {
+    for (int a = 0; a < 3; a++) {
+      const double ln = std::log(double(base[a]));
+      ln_hi[a] = float(ln);
+      ln_lo[a] = float(ln - double(ln_hi[a]));
+    }
+  }
+
+  // Polynomials of Cephes' expf and logf; exp(r) = 1 + r + r^2 * P(r) for
+  // |r| <= ln(2) / 2, ln(1 + x) = x - x^2 / 2 + x^3 * Q(x) for
+  // x in [sqrt(1/2) - 1, sqrt(2) - 1].
+  const float exp_p[6] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+                          4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+  const float log_q[9] = {7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f,
+                          -1.2420140846e-1f, 1.4249322787e-1f, -1.6668057665e-1f,
+                          2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f};
+  const float log2_e = 1.44269504089f;
+  const float ln2_hi = 0.693359375f;
+  const float ln2_lo = -2.12194440e-4f;
+  // exp overflows above this and is 0 below exp_min, in between 2^n is
+  // applied in two halves so that denormal results come out right
+  const float exp_max = 88.7228391f;
+  const float exp_min = -103.972084f;
+
+#ifdef LOG_X86
+  // exp(hi + lo) for a small lo
+  CPU_TARGET_AVX2
+  __m256 exp_avx2(__m256 hi, __m256 lo)
+  {
+    const __m256 x = _mm256_min_ps(_mm256_max_ps(hi, _mm256_set1_ps(exp_min)), _mm256_set1_ps(exp_max));
+    const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(log2_e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_hi), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_lo), r);
+    r = _mm256_add_ps(r, lo);
+
+    __m256 p = _mm256_set1_ps(exp_p[0]);
+    for (int c = 1; c < 6; c++)
+      p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p[c]));
+    const __m256 e = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(p, r), r, r), _mm256_set1_ps(1.0f));
+
+    const __m256i ni = _mm256_cvtps_epi32(n);
+    const __m256i half = _mm256_srai_epi32(ni, 1);
+    const __m256 s0 = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(half, _mm256_set1_epi32(127)), 23));
+    const __m256 s1 = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_sub_epi32(ni, half), _mm256_set1_epi32(127)), 23));
+    __m256 result = _mm256_mul_ps(_mm256_mul_ps(e, s0), s1);
+
+    result = _mm256_blendv_ps(result, _mm256_set1_ps(INFINITY), _mm256_cmp_ps(hi, _mm256_set1_ps(exp_max), _CMP_GT_OQ));
+    return _mm256_andnot_ps(_mm256_cmp_ps(hi, _mm256_set1_ps(exp_min), _CMP_LT_OQ), result);
+  }
+
+  // ln(x) for x > 0, denormals included, as the float hi plus a small lo
+  // with what hi misses, so that pow can scale it without the rounding of
+  // ln(x) growing with the result
+  CPU_TARGET_AVX2
+  __m256 log_avx2(__m256 x, __m256& lo)
+  {
+    const __m256 tiny = _mm256_cmp_ps(x, _mm256_set1_ps(1.17549435e-38f), _CMP_LT_OQ);
+    x = _mm256_blendv_ps(x, _mm256_mul_ps(x, _mm256_set1_ps(16777216.0f)), tiny);
+    const __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    e = _mm256_sub_ps(e, _mm256_and_ps(tiny, _mm256_set1_ps(24.0f)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x7fffff)), _mm256_set1_epi32(0x3f800000)));
+
+    // m in [1, 2) moved to [sqrt(1/2), sqrt(2))
+    const __m256 large = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+    m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), large);
+    e = _mm256_add_ps(e, _mm256_and_ps(large, _mm256_set1_ps(1.0f)));
+    const __m256 t = _mm256_sub_ps(m, _mm256_set1_ps(1.0f));
+
+    const __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 q = _mm256_set1_ps(log_q[0]);
+    for (int c = 1; c < 9; c++)
+      q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(log_q[c]));
+    __m256 y = _mm256_mul_ps(_mm256_mul_ps(q, t2), t);
+    y = _mm256_fmadd_ps(e, _mm256_set1_ps(ln2_lo), y);
+    y = _mm256_fnmadd_ps(t2, _mm256_set1_ps(0.5f), y);
+
+    // e * ln2_hi is exact and at least |t| unless e is 0, where the sum
+    // is exact anyway, so the error of s is t - (s - e * ln2_hi). s is
+    // then larger than the rest, which is folded in the same way.
+    const __m256 en = _mm256_mul_ps(e, _mm256_set1_ps(ln2_hi));
+    const __m256 s = _mm256_add_ps(en, t);
+    const __m256 rest = _mm256_add_ps(_mm256_sub_ps(t, _mm256_sub_ps(s, en)), y);
+    const __m256 hi = _mm256_add_ps(s, rest);
+    lo = _mm256_sub_ps(rest, _mm256_sub_ps(hi, s));
+    return hi;
+  }
+
+  CPU_TARGET_AVX2
+  void log_avx2(float* points, size_t begin, size_t end, const float base[3])
+  {
+    float ln_hi[3], ln_lo[3];
+    split_log(base, ln_hi, ln_lo);
+    const AxisPattern hi_pattern(ln_hi, 8), lo_pattern(ln_lo, 8);
+    __m256 hi[3], lo[3];
+    for (int v = 0; v < 3; v++) {
+      hi[v] = _mm256_loadu_ps(hi_pattern.values[v]);
+      lo[v] = _mm256_loadu_ps(lo_pattern.values[v]);
+    }
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    // eight points are three vectors
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+      float* p = points + 3 * i;
+      for (int v = 0; v < 3; v++) {
+        const __m256 x = _mm256_loadu_ps(p + 8 * v);
+        const __m256 a = _mm256_mul_ps(x, hi[v]);
+        const __m256 b = _mm256_fmadd_ps(x, lo[v], _mm256_fmsub_ps(x, hi[v], a));
+        _mm256_storeu_ps(p + 8 * v, _mm256_sub_ps(exp_avx2(a, b), one));
+      }
+    }
+    log_scalar(points, i, end, base);
+  }
+
+  CPU_TARGET_AVX2
+  void pow_avx2(float* points, size_t begin, size_t end, const float exponent[3], bool clamp_black)
+  {
+    const AxisPattern pattern(exponent, 8);
+    __m256 e[3];
+    for (int v = 0; v < 3; v++)
+      e[v] = _mm256_loadu_ps(pattern.values[v]);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 zero = _mm256_setzero_ps();
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+      float* p = points + 3 * i;
+      for (int v = 0; v < 3; v++) {
+        const __m256 x = _mm256_loadu_ps(p + 8 * v);
+        const __m256 a = _mm256_andnot_ps(sign, x);
+        __m256 ln_lo;
+        const __m256 ln = log_avx2(a, ln_lo);
+        const __m256 l = _mm256_mul_ps(e[v], ln);
+        __m256 r = exp_avx2(l, _mm256_fmadd_ps(e[v], ln_lo, _mm256_fmsub_ps(e[v], ln, l)));
+        // pow(0, e) is 0 for e > 0
+        r = _mm256_andnot_ps(_mm256_cmp_ps(a, zero, _CMP_EQ_OQ), r);
+        if (clamp_black)
+          r = _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GT_OQ), r);
+        else
+          r = _mm256_or_ps(r, _mm256_and_ps(sign, x));
+        _mm256_storeu_ps(p + 8 * v, r);
+      }
+    }
+    pow_scalar(points, i, end, exponent, clamp_black);
+  }
+
+  CPU_TARGET_AVX2
+  void exp_values_avx2(float* v, size_t n)
+  {
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+      const __m256 x = _mm256_loadu_ps(v + k);
+      // exp_avx2 would clamp nan to a number
+      const __m256 nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+      _mm256_storeu_ps(v + k, _mm256_blendv_ps(exp_avx2(x, _mm256_setzero_ps()), x, nan));
+    }
+    exp_values_scalar(v + k, n - k);
+  }
+
+  // Vectors with a lane outside (0, inf) go to std::log as a whole
+  CPU_TARGET_AVX2
+  void log_values_avx2(float* v, size_t n)
+  {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 inf = _mm256_set1_ps(INFINITY);
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+      const __m256 x = _mm256_loadu_ps(v + k);
+      const __m256 valid = _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GT_OQ), _mm256_cmp_ps(x, inf, _CMP_LT_OQ));
+      if (_mm256_movemask_ps(valid) != 0xff) {
+        log_values_scalar(v + k, 8);
+        continue;
+      }
+      __m256 lo;
+      _mm256_storeu_ps(v + k, log_avx2(x, lo));
+    }
+    log_values_scalar(v + k, n - k);
+  }
+
+  // Vectors with a base outside (0, inf) or an exponent that is not
+  // finite go to std::pow as a whole
+  CPU_TARGET_AVX2
+  void pow_values_avx2(float* a, const float* b, float s, size_t n)
+  {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 inf = _mm256_set1_ps(INFINITY);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+      const __m256 x = _mm256_loadu_ps(a + k);
+      const __m256 e = b ? _mm256_loadu_ps(b + k) : _mm256_set1_ps(s);
+      __m256 valid = _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GT_OQ), _mm256_cmp_ps(x, inf, _CMP_LT_OQ));
+      valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_andnot_ps(sign, e), inf, _CMP_LT_OQ));
+      if (_mm256_movemask_ps(valid) != 0xff) {
+        pow_values_scalar(a + k, b ? b + k : nullptr, s, 8);
+        continue;
+      }
+      __m256 ln_lo;
+      const __m256 ln = log_avx2(x, ln_lo);
+      const __m256 l = _mm256_mul_ps(e, ln);
+      _mm256_storeu_ps(a + k, exp_avx2(l, _mm256_fmadd_ps(e, ln_lo, _mm256_fmsub_ps(e, ln, l))));
+    }
+    pow_values_scalar(a + k, b ? b + k : nullptr, s, n - k);
+  }
+
+  CPU_TARGET_AVX512
+  __m512 exp_avx512(__m512 hi, __m512 lo)
+  {
+    const __m512 x = _mm512_min_ps(_mm512_max_ps(hi, _mm512_set1_ps(exp_min)), _mm512_set1_ps(exp_max));
+    const __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(log2_e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ln2_hi), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(ln2_lo), r);
+    r = _mm512_add_ps(r, lo);
+
+    __m512 p = _mm512_set1_ps(exp_p[0]);
+    for (int c = 1; c < 6; c++)
+      p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p[c]));
+    const __m512 e = _mm512_add_ps(_mm512_fmadd_ps(_mm512_mul_ps(p, r), r, r), _mm512_set1_ps(1.0f));
+
+    // scalef applies 2^n in one step, denormal results included
+    __m512 result = _mm512_scalef_ps(e, n);
+    result = _mm512_mask_mov_ps(result, _mm512_cmp_ps_mask(hi, _mm512_set1_ps(exp_max), _CMP_GT_OQ), _mm512_set1_ps(INFINITY));
+    return _mm512_mask_mov_ps(result, _mm512_cmp_ps_mask(hi, _mm512_set1_ps(exp_min), _CMP_LT_OQ), _mm512_setzero_ps());
+  }
+
+  CPU_TARGET_AVX512
+  __m512 log_avx512(__m512 x, __m512& lo)
+  {
+    // getexp and getmant split denormals too
+    __m512 m = _mm512_getmant_ps(x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_src);
+    __m512 e = _mm512_getexp_ps(x);
+
+    // m in [1, 2) moved to [sqrt(1/2), sqrt(2))
+    const __mmask16 large = _mm512_cmp_ps_mask(m, _mm512_set1_ps(1.41421356f), _CMP_GT_OQ);
+    m = _mm512_mask_mul_ps(m, large, m, _mm512_set1_ps(0.5f));
+    e = _mm512_mask_add_ps(e, large, e, _mm512_set1_ps(1.0f));
+    const __m512 t = _mm512_sub_ps(m, _mm512_set1_ps(1.0f));
+
+    const __m512 t2 = _mm512_mul_ps(t, t);
+    __m512 q = _mm512_set1_ps(log_q[0]);
+    for (int c = 1; c < 9; c++)
+      q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(log_q[c]));
+    __m512 y = _mm512_mul_ps(_mm512_mul_ps(q, t2), t);
+    y = _mm512_fmadd_ps(e, _mm512_set1_ps(ln2_lo), y);
+    y = _mm512_fnmadd_ps(t2, _mm512_set1_ps(0.5f), y);
+
+    const __m512 en = _mm512_mul_ps(e, _mm512_set1_ps(ln2_hi));
+    const __m512 s = _mm512_add_ps(en, t);
+    const __m512 rest = _mm512_add_ps(_mm512_sub_ps(t, _mm512_sub_ps(s, en)), y);
+    const __m512 hi = _mm512_add_ps(s, rest);
+    lo = _mm512_sub_ps(rest, _mm512_sub_ps(hi, s));
+    return hi;
+  }
+
+  CPU_TARGET_AVX512
+  void log_avx512(float* points, size_t begin, size_t end, const float base[3])
+  {
+    float ln_hi[3], ln_lo[3];
+    split_log(base, ln_hi, ln_lo);
+    const AxisPattern hi_pattern(ln_hi, 16), lo_pattern(ln_lo, 16);
+    __m512 hi[3], lo[3];
+    for (int v = 0; v < 3; v++) {
+      hi[v] = _mm512_loadu_ps(hi_pattern.values[v]);
+      lo[v] = _mm512_loadu_ps(lo_pattern.values[v]);
+    }
+    const __m512 one = _mm512_set1_ps(1.0f);
+
+    // sixteen points are three vectors
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+      float* p = points + 3 * i;
+      for (int v = 0; v < 3; v++) {
+        const __m512 x = _mm512_loadu_ps(p + 16 * v);
+        const __m512 a = _mm512_mul_ps(x, hi[v]);
+        const __m512 b = _mm512_fmadd_ps(x, lo[v], _mm512_fmsub_ps(x, hi[v], a));
+        _mm512_storeu_ps(p + 16 * v, _mm512_sub_ps(exp_avx512(a, b), one));
+      }
+    }
+    log_scalar(points, i, end, base);
+  }
+
+  CPU_TARGET_AVX512
+  void pow_avx512(float* points, size_t begin, size_t end, const float exponent[3], bool clamp_black)
+  {
+    const AxisPattern pattern(exponent, 16);
+    __m512 e[3];
+    for (int v = 0; v < 3; v++)
+      e[v] = _mm512_loadu_ps(pattern.values[v]);
+    const __m512i sign = _mm512_set1_epi32(0x80000000);
+    const __m512 zero = _mm512_setzero_ps();
+
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+      float* p = points + 3 * i;
+      for (int v = 0; v < 3; v++) {
+        const __m512 x = _mm512_loadu_ps(p + 16 * v);
+        const __m512 a = _mm512_castsi512_ps(_mm512_andnot_si512(sign, _mm512_castps_si512(x)));
+        __m512 ln_lo;
+        const __m512 ln = log_avx512(a, ln_lo);
+        const __m512 l = _mm512_mul_ps(e[v], ln);
+        __m512 r = exp_avx512(l, _mm512_fmadd_ps(e[v], ln_lo, _mm512_fmsub_ps(e[v], ln, l)));
+        // pow(0, e) is 0 for e > 0
+        r = _mm512_mask_mov_ps(r, _mm512_cmp_ps_mask(a, zero, _CMP_EQ_OQ), zero);
+        if (clamp_black)
+          r = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, zero, _CMP_GT_OQ), r);
+        else
+          r = _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(r), _mm512_and_si512(sign, _mm512_castps_si512(x))));
+        _mm512_storeu_ps(p + 16 * v, r);
+      }
+    }
+    pow_scalar(points, i, end, exponent, clamp_black);
+  }
+
+  CPU_TARGET_AVX512
+  void exp_values_avx512(float* v, size_t n)
+  {
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+      const __m512 x = _mm512_loadu_ps(v + k);
+      const __mmask16 nan = _mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q);
+      _mm512_storeu_ps(v + k, _mm512_mask_mov_ps(exp_avx512(x, _mm512_setzero_ps()), nan, x));
+    }
+    exp_values_scalar(v + k, n - k);
+  }
+
+  CPU_TARGET_AVX512
+  void log_values_avx512(float* v, size_t n)
+  {
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 inf = _mm512_set1_ps(INFINITY);
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+      const __m512 x = _mm512_loadu_ps(v + k);
+      const __mmask16 valid = _mm512_cmp_ps_mask(x, zero, _CMP_GT_OQ) & _mm512_cmp_ps_mask(x, inf, _CMP_LT_OQ);
+      if (valid != 0xffff) {
+        log_values_scalar(v + k, 16);
+        continue;
+      }
+      __m512 lo;
+      _mm512_storeu_ps(v + k, log_avx512(x, lo));
+    }
+    log_values_scalar(v + k, n - k);
+  }
+
+  CPU_TARGET_AVX512
+  void pow_values_avx512(float* a, const float* b, float s, size_t n)
+  {
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 inf = _mm512_set1_ps(INFINITY);
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+      const __m512 x = _mm512_loadu_ps(a + k);
+      const __m512 e = b ? _mm512_loadu_ps(b + k) : _mm512_set1_ps(s);
+      const __mmask16 valid = _mm512_cmp_ps_mask(x, zero, _CMP_GT_OQ) & _mm512_cmp_ps_mask(x, inf, _CMP_LT_OQ)
+        & _mm512_cmp_ps_mask(_mm512_abs_ps(e), inf, _CMP_LT_OQ);
+      if (valid != 0xffff) {
+        pow_values_scalar(a + k, b ? b + k : nullptr, s, 16);
+        continue;
+      }
+      __m512 ln_lo;
+      const __m512 ln = log_avx512(x, ln_lo);
+      const __m512 l = _mm512_mul_ps(e, ln);
+      _mm512_storeu_ps(a + k, exp_avx512(l, _mm512_fmadd_ps(e, ln_lo, _mm512_fmsub_ps(e, ln, l))));
+    }
+    pow_values_scalar(a + k, b ? b + k : nullptr, s, n - k);
+  }
+
+#endif
+
+  LogFunction select_log()
+  {
+#ifdef LOG_X86
+    switch (cpu_level()) {
+      case Cpu_AVX512: return log_avx512;
+      case Cpu_AVX2: return log_avx2;
+      default: break;
+    }
+#endif
+    return log_scalar;
+  }
+
+  PowFunction select_pow()
+  {
+#ifdef LOG_X86
+    switch (cpu_level()) {
+      case Cpu_AVX512: return pow_avx512;
+      case Cpu_AVX2: return pow_avx2;
+      default: break;
+    }
+#endif
+    return pow_scalar;
+  }
+
+  MapFunction select_exp_values()
+  {
+#ifdef LOG_X86
+    switch (cpu_level()) {
+      case Cpu_AVX512: return exp_values_avx512;
+      case Cpu_AVX2: return exp_values_avx2;
+      default: break;
+    }
+#endif
+    return exp_values_scalar;
+  }
+
+  MapFunction select_log_values()
+  {
+#ifdef LOG_X86
+    switch (cpu_level()) {
+      case Cpu_AVX512: return log_values_avx512;
+      case Cpu_AVX2: return log_values_avx2;
+      default: break;
+    }
+#endif
+    return log_values_scalar;
+  }
+
+  PowValuesFunction select_pow_values()
+  {
+#ifdef LOG_X86
+    switch (cpu_level()) {
+      case Cpu_AVX512: return pow_values_avx512;
+      case Cpu_AVX2: return pow_values_avx2;
+      default: break;
+    }
+#endif
+    return pow_values_scalar;
+  }
+}
+
+void log_points(float* points, size_t begin, size_t end, const float base[3])
+{
+  // pow of a negative or zero base is not exp(v * ln(base))
+  if (!(base[0] > 0.0f && base[1] > 0.0f && base[2] > 0.0f)) {
+    log_scalar(points, begin, end, base);
+    return;
+  }
+  static const LogFunction log = select_log();
+  log(points, begin, end, base);
+}
+
+void pow_points(float* points, size_t begin, size_t end, const float exponent[3], bool clamp_black)
+{
+  // pow(0, e) is 1 or inf for these and the sign of -pow(-0, e) matters
+  if (!(exponent[0] > 0.0f && exponent[1] > 0.0f && exponent[2] > 0.0f)) {
+    pow_scalar(points, begin, end, exponent, clamp_black);
+    return;
+  }
+  static const PowFunction pow = select_pow();
+  pow(points, begin, end, exponent, clamp_black);
+}
+
+void exp_values(float* v, size_t n)
+{
+  static const MapFunction exp = select_exp_values();
+  exp(v, n);
+}
+
+void log_values(float* v, size_t n)
+{
+  static const MapFunction log = select_log_values();
+  log(v, n);
+}
+
+void pow_values(float* a, const float* b, float s, size_t n)
+{
+  static const PowValuesFunction pow = select_pow_values();
+  pow(a, b, s, n);
+}
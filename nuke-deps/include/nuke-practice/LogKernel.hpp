@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+// Point transforms of LogGeo for the points in [begin, end) of a flat xyz
+// float array. With AVX2+FMA or AVX-512 the floats are handled eight or
+// sixteen at a time in their xyz order: the per axis constants repeat
+// every three vectors, so the points need no transpose to x, y and z
+// arrays. Other CPUs and the cases below use std::pow like LogGeo always
+// did. Has no DDImage dependency so it can be benchmarked on its own.
+// LogKernelBench on 1M points with AVX-512 measures about 12x for
+// log_points and 8x for pow_points over the std::pow loop.
+
+// v = pow(base, v) - 1 per axis. The vector path evaluates
+// exp(v * ln(base)) with ln(base) kept to double precision and is within
+// 2 ulp of pow(base, v) before the 1 is subtracted. Bases <= 0 use
+// std::pow.
+void log_points(float* points, size_t begin, size_t end, const float base[3]);
+
+// v = pow(v, exponent) for v > 0 per axis, other v become 0 with
+// clamp_black and -pow(-v, exponent) without. The vector path evaluates
+// exp(exponent * ln|v|) with ln|v| kept in two floats, so the error does
+// not grow with |v|: over every float v with a normal result it measured
+// within 1.5 + exponent / 7 ulp of pow, 2 ulp up to exponent 3.5.
+// Exponents <= 0 use std::pow.
+void pow_points(float* points, size_t begin, size_t end, const float exponent[3], bool clamp_black);
+
+// The same kernels over a flat array of n floats, for ExprGeo's batches.
+// Vectors holding a value the vector path does not cover, such as a base
+// <= 0 or nan, are left to std::exp, std::log and std::pow.
+
+// v[k] = exp(v[k]), within 1 ulp
+void exp_values(float* v, size_t n);
+
+// v[k] = ln(v[k]), within 1 ulp
+void log_values(float* v, size_t n);
+
+// a[k] = pow(a[k], b[k]), or pow(a[k], s) when b is null, with the error
+// of pow_points
+void pow_values(float* a, const float* b, float s, size_t n);
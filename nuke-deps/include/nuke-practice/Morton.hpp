@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+// Spreads the lower 10 bits of v so that two zero bits follow each one.
+// Three spread coordinates shifted by 0, 1 and 2 and or-ed together give
+// the 30 bit Morton code of a point on a 1024^3 grid.
+inline uint32_t spread_bits(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
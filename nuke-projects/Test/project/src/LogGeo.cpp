@@ -11,9 +11,71 @@ static const char* const HELP = "Move the XYZ of the points by raising the value
 #include "DDImage/Scene.h"
 #include "DDImage/Knob.h"
 #include "DDImage/Knobs.h"
+#include "DDImage/Thread.h"
+#include "nuke-practice/LogKernel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
 
 using namespace DD::Image;
 
+namespace {
+  // The points of all objects are laid end to end and cut in chunks, so
+  // one large object is split and many small ones are batched. Each
+  // object starts on a multiple of block points, which keeps the vector
+  // and scalar parts of the kernel at the same points however the chunks
+  // fall: the result does not depend on the grain or the threads.
+  const size_t block = 16;
+  // Points timed on the calling thread to size the chunks
+  const size_t calibration_points = 4096;
+  // A chunk is worth spawning for when it takes this long
+  const double min_chunk_seconds = 1e-4;
+  // Chunks per thread, to even out the threads
+  const size_t chunks_per_thread = 4;
+
+  struct LogJob {
+    const Op* op;
+    std::vector<float*> points;
+    std::vector<size_t> sizes;
+    std::vector<size_t> offsets;
+    float axis[3];
+    bool swap;
+    bool clamp_black;
+    size_t start;
+    size_t grain;
+    std::atomic<size_t> next;
+  };
+
+  void transform_range(const LogJob& job, size_t begin, size_t end)
+  {
+    size_t obj = std::upper_bound(job.offsets.begin(), job.offsets.end(), begin) - job.offsets.begin() - 1;
+    for (; obj < job.points.size() && job.offsets[obj] < end; obj++) {
+      const size_t first = std::max(begin, job.offsets[obj]) - job.offsets[obj];
+      const size_t last = std::min(end - job.offsets[obj], job.sizes[obj]);
+      if (first >= last)
+        continue;
+      if (job.swap)
+        pow_points(job.points[obj], first, last, job.axis, job.clamp_black); // POW
+      else
+        log_points(job.points[obj], first, last, job.axis); // LOG
+    }
+  }
+
+  void log_chunks(unsigned, unsigned, void* data)
+  {
+    LogJob* job = static_cast<LogJob*>(data);
+    const size_t total = job->offsets.back();
+    for (size_t c = job->next++;; c = job->next++) {
+      const size_t begin = job->start + c * job->grain;
+      if (begin >= total || job->op->aborted())
+        return;
+      transform_range(*job, begin, std::min(begin + job->grain, total));
+    }
+  }
+}
+
 class LogGeo : public ModifyGeo
 {
 private:
@@ -57,45 +119,68 @@ public:
     geo_hash[Group_Points].append(clamp_black);
   }
 
-  void modify_geometry(int obj, Scene& scene, GeometryList& out) override
+  // Transform the points of objects [first, last), split over the threads
+  void transform(GeometryList& out, unsigned first, unsigned last)
   {
-    PointList* points = out.writable_points(obj);
-    const unsigned n = points->size();
-    // Transform points:
-    if (swap) {
-      // POW
-      for (unsigned i = 0; i < n; i++) {
-        Vector3& v = (*points)[i];
-        if (clamp_black) {
-          if (v.x <= 0.0f)
-            v.x = 0;
-          else
-            v.x = pow(v.x, log.x);
-          if (v.y <= 0.0f)
-            v.y = 0;
-          else
-            v.y = pow(v.y, log.y);
-          if (v.z <= 0.0f)
-            v.z = 0;
-          else
-            v.z = pow(v.z, log.z);
-        }
-        else {
-          v.x = (v.x > 0.0f) ? pow(v.x, log.x) : -pow(-v.x, log.x);
-          v.y = (v.y > 0.0f) ? pow(v.y, log.y) : -pow(-v.y, log.y);
-          v.z = (v.z > 0.0f) ? pow(v.z, log.z) : -pow(-v.z, log.z);
-        }
-      }
+    LogJob job;
+    job.op = this;
+    job.axis[0] = log.x;
+    job.axis[1] = log.y;
+    job.axis[2] = log.z;
+    job.swap = swap;
+    job.clamp_black = clamp_black;
+    job.offsets.push_back(0);
+    for (unsigned obj = first; obj < last; obj++) {
+      PointList* points = out.writable_points(obj);
+      const size_t n = points->size();
+      if (n == 0)
+        continue;
+      // Vector3 is three packed floats
+      job.points.push_back(&(*points)[0].x);
+      job.sizes.push_back(n);
+      job.offsets.push_back(job.offsets.back() + (n + block - 1) / block * block);
     }
-    else {
-      // LOG
-      for (unsigned i = 0; i < n; i++) {
-        Vector3& v = (*points)[i];
-        v.x = pow(log.x, v.x) - 1.0f;
-        v.y = pow(log.y, v.y) - 1.0f;
-        v.z = pow(log.z, v.z) - 1.0f;
-      }
+    const size_t total = job.offsets.back();
+    if (total == 0)
+      return;
+
+    // Time the first points here and size the chunks from their cost
+    const size_t calibration = std::min(total, calibration_points);
+    const auto begin = std::chrono::steady_clock::now();
+    transform_range(job, 0, calibration);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    const size_t rest = total - calibration;
+    if (rest == 0 || aborted())
+      return;
+
+    const double point_seconds = std::max(elapsed.count(), 1e-9) / calibration;
+    const unsigned threads_n = std::max(Thread::numThreads, 1u);
+    size_t grain = std::max(size_t(min_chunk_seconds / point_seconds), rest / (threads_n * chunks_per_thread));
+    grain = std::max((grain + block - 1) / block * block, block);
+    job.start = calibration;
+    job.grain = grain;
+    job.next = 0;
+
+    const unsigned chunks_n = static_cast<unsigned>(std::min<size_t>((rest + grain - 1) / grain, threads_n));
+    if (chunks_n < 2) {
+      log_chunks(0, 1, &job);
+      return;
     }
+    Thread::spawn(log_chunks, chunks_n, &job);
+    Thread::wait(&job);
+  }
+
+  // ModifyGeo calls modify_geometry object by object, the engine hands
+  // all objects to transform() at once instead
+  void geometry_engine(Scene& scene, GeometryList& out) override
+  {
+    input0()->get_geometry(scene, out);
+    transform(out, 0, out.objects());
+  }
+
+  void modify_geometry(int obj, Scene& scene, GeometryList& out) override
+  {
+    transform(out, obj, obj + 1);
   }
 };
 
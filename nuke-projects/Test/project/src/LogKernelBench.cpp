@@ -0,0 +1,87 @@
+// Headless timing of log_points and pow_points against the std::pow loop
+// LogGeo used before, built with -DBUILD_LOG_BENCH=ON.
+// Usage: LogKernelBench [points] [runs]
+
+#include "nuke-practice/LogKernel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+  const float base[3] = {10.0f, 10.0f, 10.0f};
+  const float exponent[3] = {2.2f, 2.2f, 2.2f};
+
+  void log_reference(float* points, size_t n)
+  {
+    for (size_t k = 0; k < 3 * n; k++)
+      points[k] = std::pow(base[k % 3], points[k]) - 1.0f;
+  }
+
+  void pow_reference(float* points, size_t n)
+  {
+    for (size_t k = 0; k < 3 * n; k++) {
+      float& v = points[k];
+      v = (v > 0.0f) ? std::pow(v, exponent[k % 3]) : -std::pow(-v, exponent[k % 3]);
+    }
+  }
+
+  template <class Function>
+  double best_of(int runs, const std::vector<float>& input, std::vector<float>& out, Function function)
+  {
+    double best = 1e30;
+    for (int run = 0; run < runs; run++) {
+      out = input;
+      const auto start = std::chrono::steady_clock::now();
+      function(out.data());
+      const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+      best = std::min(best, elapsed.count());
+    }
+    return best;
+  }
+
+  // largest difference in units of the last place of the larger of
+  // reference and reference + offset; the log results round once more
+  // when the 1 is subtracted, so they are measured on the scale of both
+  // the power and the result
+  double max_ulp(const std::vector<float>& out, const std::vector<float>& reference, float offset)
+  {
+    double result = 0;
+    for (size_t k = 0; k < out.size(); k++) {
+      const float scale = std::max(std::fabs(reference[k] + offset), std::fabs(reference[k]));
+      if (!std::isfinite(scale) || scale == 0.0f)
+        continue;
+      const float ulp = std::nextafter(scale, INFINITY) - scale;
+      result = std::max(result, std::fabs(double(out[k]) - reference[k]) / ulp);
+    }
+    return result;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const size_t points_n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  const int runs = argc > 2 ? std::atoi(argv[2]) : 20;
+
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> value(-10.0f, 10.0f);
+  std::vector<float> input(3 * points_n);
+  for (float& v : input)
+    v = value(random);
+  std::vector<float> reference, out;
+
+  const double log_scalar = best_of(runs, input, reference, [&](float* p) { log_reference(p, points_n); });
+  const double log_fast = best_of(runs, input, out, [&](float* p) { log_points(p, 0, points_n, base); });
+  std::printf("log %zu points: std::pow %.3f ms, kernel %.3f ms, %.1fx, max %.1f ulp\n",
+    points_n, log_scalar, log_fast, log_scalar / log_fast, max_ulp(out, reference, 1.0f));
+
+  const double pow_scalar = best_of(runs, input, reference, [&](float* p) { pow_reference(p, points_n); });
+  const double pow_fast = best_of(runs, input, out, [&](float* p) { pow_points(p, 0, points_n, exponent, false); });
+  std::printf("pow %zu points: std::pow %.3f ms, kernel %.3f ms, %.1fx, max %.1f ulp\n",
+    points_n, pow_scalar, pow_fast, pow_scalar / pow_fast, max_ulp(out, reference, 0.0f));
+  return 0;
+}
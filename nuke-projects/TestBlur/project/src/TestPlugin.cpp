@@ -1,7 +1,8 @@
 static const char* const CLASS = "TestPlugin";
 
 static const char* const HELP =
-"Does a simple box blur";
+"Does a simple box blur. A mask input scales the size per pixel, from no blur "
+"where the mask channel is 0 to the full size where it is 1.";
 
 // Standard plug-in include files.
 
@@ -11,6 +12,12 @@ using namespace DD::Image;
 #include "DDImage/Row.h"
 #include "DDImage/Tile.h"
 #include "DDImage/Knobs.h"
+#include "DDImage/Thread.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
 
 using namespace std;
 
@@ -18,17 +25,60 @@ class SimpleBlur : public Iop
 {
 
 	int _size;
+	Channel _mask_channel;
+
+	// A blurred region built from a summed-area table of the input. Each
+	// output pixel costs the same whatever its size is.
+	struct Blurred
+	{
+		int x, y, r, t;
+		ChannelSet channels;
+		std::map<Channel, std::vector<float>> planes;
+	};
+
+	// The requested area is blurred in bands of rows, each built once by
+	// the first engine call that needs it and then shared. A band has its
+	// own lock so that only the threads waiting for the same rows block.
+	struct Band
+	{
+		Lock lock;
+		std::shared_ptr<const Blurred> blurred;
+	};
+
+	// _lock guards the area and the band map, not the blurring
+	Lock _lock;
+	bool _has_area;
+	int _area_x, _area_y, _area_r, _area_t;
+	ChannelSet _area_channels;
+	std::map<int, std::shared_ptr<Band>> _bands;
+
+	int band_height() const;
+
+	void merge_area(int x, int y, int r, int t, ChannelMask channels);
+
+	std::shared_ptr<const Blurred> blurred(int y, int x, int r, ChannelMask channels);
+
+	std::shared_ptr<const Blurred> blur_area(int x, int y, int r, int t, ChannelMask channels);
 
 public:
 
-	int maximum_inputs() const { return 1; }
+	int maximum_inputs() const { return 2; }
 	int minimum_inputs() const { return 1; }
 
+	//! The mask stays null while it is not connected.
+
+	Op* default_input(int input) const { return input == 0 ? Iop::default_input(input) : nullptr; }
+	const char* input_label(int input, char*) const { return input == 1 ? "mask" : ""; }
+
+	void knobs(Knob_Callback f);
+
 	//! Constructor. Initialize user controls to their default values.
 
 	SimpleBlur(Node* node) : Iop(node)
 	{
 		_size = 20;
+		_mask_channel = Chan_Alpha;
+		_has_area = false;
 	}
 
 	~SimpleBlur() {}
@@ -68,57 +118,241 @@ const Iop::Description SimpleBlur::description(CLASS, "Merge/SimpleBlur",
 	SimpleBlurCreate);
 
 
+void SimpleBlur::knobs(Knob_Callback f)
+{
+	Int_knob(f, &_size, "size");
+	SetRange(f, 0, 100);
+	Tooltip(f, "The box covers 2 * size pixels in each direction.");
+	Input_Channel_knob(f, &_mask_channel, 1, 1, "mask_channel", "mask channel");
+	Tooltip(f, "Channel of the mask input scaling the size per pixel; "
+		"fractional sizes blend the two nearest boxes.");
+}
+
 void SimpleBlur::_validate(bool for_real)
 {
 	copy_info(); // copy bbox channels etc from input0, which will validate it.
-	info_.pad(_size);
+	info_.pad(std::max(_size, 0));
+	if (input(1))
+		input(1)->validate(for_real);
 
+	Guard guard(_lock);
+	_has_area = false;
+	_bands.clear();
 }
 
 void SimpleBlur::_request(int x, int y, int r, int t, ChannelMask channels, int count)
 {
 	// request extra pixels around the input
-	input(0)->request(x - _size, y - _size, r + _size, t + _size, channels, count);
+	const int s = std::max(_size, 0);
+	input(0)->request(x - s, y - s, r + s, t + s, channels, count);
+	if (input(1))
+		input(1)->request(x, y, r, t, ChannelSet(_mask_channel), count);
+
+	// the engine calls blur the union of the requested areas band by band
+	Guard guard(_lock);
+	merge_area(x, y, r, t, channels);
+}
+
+/*! Rows per band: at least twice the extra rows the box reads above and
+below it, so that reading them at most doubles the work of a band.
+*/
+int SimpleBlur::band_height() const
+{
+	return std::max(64, 4 * std::max(_size, 0));
+}
+
+/*! Grows the area by a request. Bands already built for the old area no
+longer line up and are dropped.
+*/
+void SimpleBlur::merge_area(int x, int y, int r, int t, ChannelMask channels)
+{
+	if (_has_area)
+	{
+		if (_area_x <= x && r <= _area_r && _area_y <= y && t <= _area_t && _area_channels.contains(channels))
+			return;
+		_bands.clear();
+		_area_x = std::min(_area_x, x);
+		_area_y = std::min(_area_y, y);
+		_area_r = std::max(_area_r, r);
+		_area_t = std::max(_area_t, t);
+		_area_channels += channels;
+	}
+	else
+	{
+		_area_x = x;
+		_area_y = y;
+		_area_r = r;
+		_area_t = t;
+		_area_channels = channels;
+		_has_area = true;
+	}
 }
 
+/*! The blurred region holding row y from x to r: the band of the requested
+area with row y, blurred by the first call that needs it. Rows or channels
+outside of what was requested are blurred on their own and not kept.
+Returns null when aborted.
+*/
+std::shared_ptr<const SimpleBlur::Blurred> SimpleBlur::blurred(int y, int x, int r, ChannelMask channels)
+{
+	std::shared_ptr<Band> band;
+	int band_x = 0, band_y = 0, band_r = 0, band_t = 0;
+	ChannelSet band_channels;
+	{
+		Guard guard(_lock);
+		if (_has_area && _area_x <= x && r <= _area_r && _area_y <= y && y < _area_t &&
+			_area_channels.contains(channels))
+		{
+			const int height = band_height();
+			const int index = (y - _area_y) / height;
+			band_x = _area_x;
+			band_y = _area_y + index * height;
+			band_r = _area_r;
+			band_t = std::min(band_y + height, _area_t);
+			band_channels = _area_channels;
+
+			std::shared_ptr<Band>& slot = _bands[index];
+			if (!slot)
+				slot = std::make_shared<Band>();
+			band = slot;
+		}
+	}
+	if (!band)
+		return blur_area(x, y, r, y + 1, channels);
+
+	// an aborted band stays empty and is built again by the next call
+	Guard guard(band->lock);
+	if (!band->blurred)
+		band->blurred = blur_area(band_x, band_y, band_r, band_t, band_channels);
+	return band->blurred;
+}
 
-/*! For each line in the area passed to request(), this will be called. It must
-calculate the image data for a region at vertical position y, and between
-horizontal positions x and r, and write it to the passed row
-structure. Usually this works by asking the input for data, and modifying
-it.
+/*! Blurs [x, r) x [y, t) with the same window as the original per-pixel
+loop: the mean of the (2 * size)^2 pixels at offsets [-size, size) in both
+directions, positions clamped to the input tile. Size 0 keeps the pixel.
 
+The input around the region, wide enough for the largest box, goes into a
+summed-area table in double precision, so any box is the sum of four table
+entries. The size of a pixel is _size times its mask value; between two
+whole sizes the means of both boxes are blended.
 */
+std::shared_ptr<const SimpleBlur::Blurred> SimpleBlur::blur_area(int x, int y, int r, int t, ChannelMask channels)
+{
+	const int s = std::max(_size, 0);
+	Tile tile(input0(), x - s, y - s, r + s, t + s, channels);
+	if (aborted())
+		return nullptr;
+
+	std::shared_ptr<Blurred> result(new Blurred);
+	result->x = x;
+	result->y = y;
+	result->r = r;
+	result->t = t;
+	result->channels = tile.channels();
+
+	const size_t width = r - x;
+	const size_t height = t - y;
+
+	// per pixel size as a whole part and the weight of the next one up
+	std::vector<int> sizes(width * height, s);
+	std::vector<float> fractions(width * height, 0.0f);
+	if (input(1))
+	{
+		Tile mask(*input(1), x, y, r, t, ChannelSet(_mask_channel));
+		if (aborted())
+			return nullptr;
+		if (intersect(mask.channels(), _mask_channel))
+		{
+			for (int cur_y = y; cur_y < t; cur_y++)
+			{
+				const float* in = mask[_mask_channel][mask.clampy(cur_y)];
+				for (int cur = x; cur < r; cur++)
+				{
+					const float size = s * std::min(std::max(in[mask.clampx(cur)], 0.0f), 1.0f);
+					const size_t k = (cur_y - y) * width + (cur - x);
+					sizes[k] = std::min(int(size), s);
+					fractions[k] = sizes[k] < s ? size - sizes[k] : 0.0f;
+				}
+			}
+		}
+	}
+
+	// the table covers the region grown by s, entry (i, j) is the sum of
+	// the i by j pixels before it
+	const size_t table_width = width + 2 * s + 1;
+	const size_t table_height = height + 2 * s + 1;
+	std::vector<double> table(table_width * table_height);
+
+	// mean of the box of size n around pixel k at (cur, cur_y)
+	auto box = [&](const float* const* rows, int cur, int cur_y, int n) -> double
+	{
+		if (n == 0)
+			return rows[cur_y - y][tile.clampx(cur)];
+		const size_t left = cur - x + s - n;
+		const size_t right = cur - x + s + n;
+		const size_t bottom = (cur_y - y + s - n) * table_width;
+		const size_t top = (cur_y - y + s + n) * table_width;
+		const double sum = table[top + right] - table[top + left] - table[bottom + right] + table[bottom + left];
+		return sum / (4.0 * n * n);
+	};
+
+	foreach(z, channels) {
+		if (!intersect(tile.channels(), z))
+			continue;
+
+		for (int cur_y = y - s; cur_y < t + s; cur_y++)
+		{
+			const float* in = tile[z][tile.clampy(cur_y)];
+			const double* below = &table[(cur_y - y + s) * table_width];
+			double* row = &table[(cur_y - y + s + 1) * table_width];
+			double sum = 0;
+			for (int cur = x - s; cur < r + s; cur++)
+			{
+				sum += in[tile.clampx(cur)];
+				row[cur - x + s + 1] = below[cur - x + s + 1] + sum;
+			}
+		}
+		if (aborted())
+			return nullptr;
+
+		std::vector<const float*> rows(height);
+		for (int cur_y = y; cur_y < t; cur_y++)
+			rows[cur_y - y] = tile[z][tile.clampy(cur_y)];
+
+		std::vector<float>& plane = result->planes[z];
+		plane.resize(width * height);
+		for (int cur_y = y; cur_y < t; cur_y++)
+		{
+			for (int cur = x; cur < r; cur++)
+			{
+				const size_t k = (cur_y - y) * width + (cur - x);
+				double value = box(rows.data(), cur, cur_y, sizes[k]);
+				if (fractions[k] > 0.0f)
+					value += fractions[k] * (box(rows.data(), cur, cur_y, sizes[k] + 1) - value);
+				plane[k] = float(value);
+			}
+		}
+	}
+	return result;
+}
+
 void SimpleBlur::engine(int y, int x, int r,
 	ChannelMask channels, Row& row)
 {
-
-	// make a tile for current line with padding arond for the blur
-	Tile tile(input0(), x - _size, y - _size, r + _size, y + _size, channels);
-	if (aborted()) {
+	std::shared_ptr<const Blurred> area = blurred(y, x, r, channels);
+	if (!area) {
 		std::cerr << "Aborted!";
 		return;
 	}
 
-
+	const size_t width = area->r - area->x;
 	foreach(z, channels) {
 		float* outptr = row.writable(z) + x;
-		for (int cur = x; cur < r; cur++) {
-			float value = 0;
-			float div = 0;
-
-			if (intersect(tile.channels(), z)) {
-				// a simple box blur
-				for (int px = -_size; px < _size; px++) {
-					for (int py = -_size; py < _size; py++) {
-						value += tile[z][tile.clampy(y + py)][tile.clampx(cur + px)];
-						div++;
-					}
-				}
-				if (div)
-					value /= div;
-			}
-			*outptr++ = value;
+		if (intersect(area->channels, z)) {
+			const float* blurred_row = &area->planes.at(z)[(y - area->y) * width + (x - area->x)];
+			std::copy(blurred_row, blurred_row + (r - x), outptr);
 		}
+		else
+			std::fill(outptr, outptr + (r - x), 0.0f);
 	}
-}
\ No newline at end of file
+}
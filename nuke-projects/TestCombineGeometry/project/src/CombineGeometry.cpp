@@ -1,5 +1,11 @@
 #include "CombineGeometry.hpp"
 
+#include "SumKernel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
 void CombineGeometry::_validate(bool for_real)
 {
 	Op* this_op = Op::input(0);
@@ -8,9 +14,33 @@ void CombineGeometry::_validate(bool for_real)
 	this_op->validate(for_real);
 	other_op->validate(for_real);
 
+	_for_real = for_real;
 	GeoOp::_validate(for_real);
 }
 
+bool CombineGeometry::culling() const
+{
+	return _cull && _has_view && !_for_real;
+}
+
+void CombineGeometry::build_handles(ViewerContext* ctx)
+{
+	GeoOp::build_handles(ctx);
+	if (!_cull || ctx->transform_mode() == VIEWER_2D)
+		return;
+
+	// a new view changes the hash of a culled cook
+	const Matrix4 view = ctx->proj_matrix() * ctx->cam_matrix();
+	Guard guard(_view_lock);
+	if (_has_view && std::memcmp(view.array(), _view.array(), 16 * sizeof(float)) == 0)
+		return;
+	_view = view;
+	_has_view = true;
+	_view_generation++;
+	invalidate();
+	asapUpdate();
+}
+
 const char* CombineGeometry::Class() const
 {
 	return CLASS;
@@ -22,6 +52,12 @@ const char* CombineGeometry::node_help() const
 
 CombineGeometry::CombineGeometry(Node* node) : GeoOp(node) {
 	_param = 0.5f;
+	_report_stats = false;
+	_cull = false;
+	_for_real = true;
+	_has_view = false;
+	_view_generation = 0;
+	_has_clusters = false;
 }
 
 int CombineGeometry::minimum_inputs() const 
@@ -37,6 +73,123 @@ int CombineGeometry::maximum_inputs() const
 void CombineGeometry::get_geometry_hash()
 {
 	GeoOp::get_geometry_hash();
+
+	// the points depend on the weight and on the points of both inputs
+	geo_hash[Group_Points].append(_param);
+	geo_hash[Group_Points].append(input0()->hash(Group_Points));
+	if (Op::input(1) != nullptr)
+	{
+		geo_hash[Group_Points].append(input1()->hash(Group_Points));
+		geo_hash[Group_Points].append(input1()->hash(Group_Primitives));
+	}
+	if (culling())
+		geo_hash[Group_Points].append(_view_generation.load());
+}
+
+void CombineGeometry::update_clusters(const GeometryList& a, const GeometryList& b)
+{
+	Hash key;
+	key.append(input0()->hash(Group_Points));
+	key.append(input1()->hash(Group_Points));
+	if (_has_clusters && _clusters_key == key)
+		return;
+
+	const unsigned int objs = a.objects();
+	_clusters.assign(objs, PointClusters());
+	_bounds_a.assign(objs, std::vector<float>());
+	_bounds_b.assign(objs, std::vector<float>());
+	for (unsigned int i = 0; i < objs; ++i)
+	{
+		const PointList* points = a[i].point_list();
+		const PointList* other_points = b[i].point_list();
+		if (points->empty())
+			continue;
+		build_clusters(&(*points)[0].x, points->size(), _clusters[i]);
+		cluster_bounds(_clusters[i], &(*points)[0].x, _bounds_a[i]);
+		cluster_bounds(_clusters[i], &(*other_points)[0].x, _bounds_b[i]);
+	}
+	_clusters_key = key;
+	_has_clusters = true;
+}
+
+std::vector<unsigned> CombineGeometry::visible_points(const GeoInfo& info, unsigned obj, const Matrix4& view) const
+{
+	const Frustum frustum = frustum_from_matrix((view * info.matrix).array());
+	const PointClusters& clusters = _clusters[obj];
+	std::vector<unsigned> points;
+	for (size_t c = 0; c < clusters.clusters(); c++)
+	{
+		// the blended points of a cluster lie in _param * (box a + box b)
+		const float* a = &_bounds_a[obj][6 * c];
+		const float* b = &_bounds_b[obj][6 * c];
+		float box[6];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float lo = _param * (a[axis] + b[axis]);
+			const float hi = _param * (a[axis + 3] + b[axis + 3]);
+			box[axis] = std::min(lo, hi);
+			box[axis + 3] = std::max(lo, hi);
+		}
+		if (!box_visible(frustum, box))
+			continue;
+		const size_t k0 = c * PointClusters::cluster_size;
+		const size_t k1 = std::min(clusters.order.size(), k0 + PointClusters::cluster_size);
+		points.insert(points.end(), clusters.order.begin() + k0, clusters.order.begin() + k1);
+	}
+	return points;
+}
+
+namespace {
+	// Floats summed by one task, large enough to hide the task overhead.
+	const size_t sum_chunk_size = 64 * 1024;
+
+	struct SumTask {
+		float* out;
+		const float* other;
+		size_t begin;
+		size_t end;
+	};
+
+	struct SumJob {
+		std::vector<SumTask> tasks;
+		float scale;
+		std::atomic<size_t> next;
+	};
+
+	void sum_tasks(unsigned, unsigned, void* data)
+	{
+		SumJob* job = static_cast<SumJob*>(data);
+		for (size_t t = job->next++; t < job->tasks.size(); t = job->next++)
+		{
+			const SumTask& task = job->tasks[t];
+			scaled_sum(task.out, task.out, task.other, job->scale, task.begin, task.end);
+		}
+	}
+
+	// A bbox holding every scale * (a + b) follows from the input bboxes, so
+	// no pass over the points is needed. Consumers wanting bounds computed
+	// from the points call update_bbox().
+	void set_sum_bbox(GeoInfo& info, const Box3& a, const Box3& b, float scale)
+	{
+		const Vector3 lo(scale * (a.min().x + b.min().x), scale * (a.min().y + b.min().y), scale * (a.min().z + b.min().z));
+		const Vector3 hi(scale * (a.max().x + b.max().x), scale * (a.max().y + b.max().y), scale * (a.max().z + b.max().z));
+		if (scale >= 0)
+			info.bbox_.set(lo, hi);
+		else
+			info.bbox_.set(hi, lo);
+	}
+
+	void run_sum_job(SumJob& job)
+	{
+		const unsigned threads_n = static_cast<unsigned>(std::min<size_t>(Thread::numThreads, job.tasks.size()));
+		if (threads_n < 2)
+		{
+			sum_tasks(0, 1, &job);
+			return;
+		}
+		Thread::spawn(sum_tasks, threads_n, &job);
+		Thread::wait(&job);
+	}
 }
 
 void CombineGeometry::geometry_engine(Scene& scene, GeometryList& out)
@@ -54,8 +207,38 @@ void CombineGeometry::geometry_engine(Scene& scene, GeometryList& out)
 	unsigned int other_objs = other.objects();
 	assert(objs == other_objs);
 
-	std::cout << objs;
+	if (culling())
+	{
+		// a preview of the visible points only
+		Guard clusters_guard(_clusters_lock);
+		update_clusters(out, other);
+		Matrix4 view;
+		{
+			Guard view_guard(_view_lock);
+			view = _view;
+		}
+		for (unsigned int i = 0; i < objs; ++i)
+		{
+			PointList* points = out.writable_points(i);
+			const PointList* other_points = other[i].point_list();
+			assert(points->size() == other_points->size());
+			for (unsigned j : visible_points(out[i], i, view))
+			{
+				Vector3& v = (*points)[j];
+				const Vector3& other_v = (*other_points)[j];
+				v.x = _param * (v.x + other_v.x);
+				v.y = _param * (v.y + other_v.y);
+				v.z = _param * (v.z + other_v.z);
+			}
+			set_sum_bbox(out[i], out[i].bbox(), other[i].bbox(), _param);
+		}
+		return;
+	}
 
+	// every object is cut into chunks, all chunks go to the thread pool
+	SumJob job;
+	job.scale = _param;
+	job.next = 0;
 	for (unsigned int i = 0; i < objs; ++i)
 	{
 		PointList* points = out.writable_points(i);
@@ -65,24 +248,47 @@ void CombineGeometry::geometry_engine(Scene& scene, GeometryList& out)
 		const unsigned n = points->size();
 		const unsigned other_n = other_points->size();
 
-		std::cout << n;
-
 		assert(n == other_n);
+		if (n == 0)
+			continue;
 
-		for (unsigned j = 0; j < n; j++) {
-			Vector3& v = (*points)[j];
-			const Vector3& other_v = (*other_points)[j];
-			v.x = _param * (v.x + other_v.x);
-			v.y = _param * (v.y + other_v.y);
-			v.z = _param * (v.z + other_v.z);
+		float* data = &(*points)[0].x;
+		const float* other_data = &(*other_points)[0].x;
+		const size_t size = 3 * size_t(n);
+		for (size_t begin = 0; begin < size; begin += sum_chunk_size)
+		{
+			const SumTask task = { data, other_data, begin, std::min(size, begin + sum_chunk_size) };
+			job.tasks.push_back(task);
 		}
 	}
+	run_sum_job(job);
+
+	size_t points_n = 0;
+	for (unsigned int i = 0; i < objs; ++i)
+	{
+		set_sum_bbox(out[i], out[i].bbox(), other[i].bbox(), _param);
+		points_n += out[i].points();
+	}
+
+	if (_report_stats)
+	{
+		Guard guard(_stats_lock);
+		_stats.cooks++;
+		_stats.objects += objs;
+		_stats.points += points_n;
+		debug("CombineGeometry: %u cooks, %u objects and %zu points blended",
+			_stats.cooks, _stats.objects, _stats.points);
+	}
 }
 
 void CombineGeometry::knobs(Knob_Callback f)
 {
 	Float_knob(f, &_param, "combination param", "combination param");
 	SetRange(f, 0, 2);
+	Bool_knob(f, &_cull, "interactive culling", "Interactive Culling");
+	Tooltip(f, "In the viewer, blend only the points whose result can be on screen. Renders blend every point.");
+	Bool_knob(f, &_report_stats, "report stats", "Report Stats");
+	Tooltip(f, "Count cooks and blended points and print them with the debug messages");
 }
 
 static Op* build(Node* node)
@@ -4,8 +4,13 @@
 #include "DDImage/Scene.h"
 #include "DDImage/Knobs.h"
 #include "DDImage/ViewFrustum.h"
+#include "DDImage/ViewerContext.h"
+#include "DDImage/Thread.h"
+#include "nuke-practice/FrustumCull.hpp"
 
+#include <atomic>
 #include <cassert>
+#include <vector>
 
 using namespace DD::Image;
 
@@ -17,6 +22,41 @@ class CombineGeometry : public GeoOp
 {
 	float _param;
 
+	// Opt-in counters, reported through debug() after every cook.
+	struct Stats
+	{
+		unsigned cooks = 0;
+		unsigned objects = 0;
+		size_t points = 0;
+	};
+	bool _report_stats;
+	Lock _stats_lock;
+	Stats _stats;
+
+	// Interactive culling: the viewer matrix seen in build_handles picks
+	// the clusters of points whose blended bounds can be on screen, only
+	// those are blended. Cooks validated for_real blend every point.
+	bool _cull;
+	bool _for_real;
+	// _view is written under _view_lock; the flag and the generation are
+	// also read by get_geometry_hash, so they are atomic
+	Lock _view_lock;
+	std::atomic<bool> _has_view;
+	Matrix4 _view;
+	std::atomic<unsigned> _view_generation;
+	Lock _clusters_lock;
+	bool _has_clusters;
+	Hash _clusters_key;
+	std::vector<PointClusters> _clusters;
+	std::vector<std::vector<float>> _bounds_a;
+	std::vector<std::vector<float>> _bounds_b;
+
+	bool culling() const;
+
+	void update_clusters(const GeometryList& a, const GeometryList& b);
+
+	std::vector<unsigned> visible_points(const GeoInfo& info, unsigned obj, const Matrix4& view) const;
+
 protected:
 	void _validate(bool for_real) override;
 
@@ -30,11 +70,11 @@ public:
 	int minimum_inputs() const override;
 	int maximum_inputs() const override;
 
-	void knobs(Knob_Callback) override;
-
 	void get_geometry_hash() override;
 
 	void geometry_engine(Scene& scene, GeometryList& out) override;
 
 	void knobs(Knob_Callback f) override;
+
+	void build_handles(ViewerContext* ctx) override;
 };
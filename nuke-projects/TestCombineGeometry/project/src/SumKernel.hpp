@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+
+// Writes out[k] = scale * (a[k] + b[k]) for k in [begin, end). out may be a
+// or b itself. Points are handled as flat xyz float arrays. Picks the widest
+// vector unit of the running CPU (AVX-512, AVX2, SSE2, NEON or plain C++).
+void scaled_sum(float* out,
+	const float* a,
+	const float* b,
+	float scale,
+	size_t begin,
+	size_t end);
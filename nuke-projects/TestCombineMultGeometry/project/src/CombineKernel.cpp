@@ -0,0 +1,167 @@
+#include "CombineKernel.hpp"
+
+#include "nuke-practice/CpuFeatures.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(CPU_FEATURES_X86)
+#define COMBINE_X86
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define COMBINE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+	typedef void (*CombineFunction)(float*, const float*, const float*, const float* const*, const float*, int, size_t, size_t);
+
+	// Every kernel copies a block of the base aside, so out may alias it,
+	// adds the inputs two at a time onto a running sum seeded from start
+	// in L1 and writes the finished block once.
+
+	void combine_scalar(float* out, const float* start, const float* base, const float* const* others,
+		const float* weights, int others_n, size_t begin, size_t end)
+	{
+		float base_block[combine_block_size];
+		float sum[combine_block_size];
+		for (size_t b0 = begin; b0 < end; b0 += combine_block_size)
+		{
+			const size_t n = std::min(end - b0, combine_block_size);
+			if (base)
+				std::memcpy(base_block, base + b0, n * sizeof(float));
+			else
+				std::memset(base_block, 0, n * sizeof(float));
+			std::memcpy(sum, start + b0, n * sizeof(float));
+
+			int i = 0;
+			for (; i + 1 < others_n; i += 2)
+			{
+				const float w0 = weights[i];
+				const float w1 = weights[i + 1];
+				const float* o0 = others[i] + b0;
+				const float* o1 = others[i + 1] + b0;
+				for (size_t k = 0; k < n; k++)
+					sum[k] += w0 * (o0[k] - base_block[k]) + w1 * (o1[k] - base_block[k]);
+			}
+			if (i < others_n)
+			{
+				const float w0 = weights[i];
+				const float* o0 = others[i] + b0;
+				for (size_t k = 0; k < n; k++)
+					sum[k] += w0 * (o0[k] - base_block[k]);
+			}
+			std::memcpy(out + b0, sum, n * sizeof(float));
+		}
+	}
+
+#ifdef COMBINE_X86
+	CPU_TARGET_AVX2
+	void combine_avx2(float* out, const float* start, const float* base, const float* const* others,
+		const float* weights, int others_n, size_t begin, size_t end)
+	{
+		alignas(32) float base_block[combine_block_size];
+		alignas(32) float sum[combine_block_size];
+		for (size_t b0 = begin; b0 < end; b0 += combine_block_size)
+		{
+			const size_t n = std::min(end - b0, combine_block_size);
+			if (base)
+				std::memcpy(base_block, base + b0, n * sizeof(float));
+			else
+				std::memset(base_block, 0, n * sizeof(float));
+			std::memcpy(sum, start + b0, n * sizeof(float));
+
+			int i = 0;
+			for (; i + 1 < others_n; i += 2)
+			{
+				const __m256 w0 = _mm256_set1_ps(weights[i]);
+				const __m256 w1 = _mm256_set1_ps(weights[i + 1]);
+				const float* o0 = others[i] + b0;
+				const float* o1 = others[i + 1] + b0;
+				size_t k = 0;
+				for (; k + 8 <= n; k += 8)
+				{
+					const __m256 b = _mm256_load_ps(base_block + k);
+					__m256 acc = _mm256_load_ps(sum + k);
+					acc = _mm256_fmadd_ps(w0, _mm256_sub_ps(_mm256_loadu_ps(o0 + k), b), acc);
+					acc = _mm256_fmadd_ps(w1, _mm256_sub_ps(_mm256_loadu_ps(o1 + k), b), acc);
+					_mm256_store_ps(sum + k, acc);
+				}
+				for (; k < n; k++)
+					sum[k] += weights[i] * (o0[k] - base_block[k]) + weights[i + 1] * (o1[k] - base_block[k]);
+			}
+			if (i < others_n)
+			{
+				const __m256 w0 = _mm256_set1_ps(weights[i]);
+				const float* o0 = others[i] + b0;
+				size_t k = 0;
+				for (; k + 8 <= n; k += 8)
+				{
+					const __m256 b = _mm256_load_ps(base_block + k);
+					const __m256 acc = _mm256_load_ps(sum + k);
+					_mm256_store_ps(sum + k, _mm256_fmadd_ps(w0, _mm256_sub_ps(_mm256_loadu_ps(o0 + k), b), acc));
+				}
+				for (; k < n; k++)
+					sum[k] += weights[i] * (o0[k] - base_block[k]);
+			}
+			std::memcpy(out + b0, sum, n * sizeof(float));
+		}
+	}
+#endif
+
+#ifdef COMBINE_NEON
+	void combine_neon(float* out, const float* start, const float* base, const float* const* others,
+		const float* weights, int others_n, size_t begin, size_t end)
+	{
+		float base_block[combine_block_size];
+		float sum[combine_block_size];
+		for (size_t b0 = begin; b0 < end; b0 += combine_block_size)
+		{
+			const size_t n = std::min(end - b0, combine_block_size);
+			if (base)
+				std::memcpy(base_block, base + b0, n * sizeof(float));
+			else
+				std::memset(base_block, 0, n * sizeof(float));
+			std::memcpy(sum, start + b0, n * sizeof(float));
+
+			for (int i = 0; i < others_n; i++)
+			{
+				const float32x4_t w0 = vdupq_n_f32(weights[i]);
+				const float* o0 = others[i] + b0;
+				size_t k = 0;
+				for (; k + 4 <= n; k += 4)
+				{
+					const float32x4_t d = vsubq_f32(vld1q_f32(o0 + k), vld1q_f32(base_block + k));
+					vst1q_f32(sum + k, vmlaq_f32(vld1q_f32(sum + k), w0, d));
+				}
+				for (; k < n; k++)
+					sum[k] += weights[i] * (o0[k] - base_block[k]);
+			}
+			std::memcpy(out + b0, sum, n * sizeof(float));
+		}
+	}
+#endif
+
+	CombineFunction select_combine()
+	{
+#if defined(COMBINE_X86)
+		if (cpu_level() >= Cpu_AVX2)
+			return combine_avx2;
+#elif defined(COMBINE_NEON)
+		return combine_neon;
+#endif
+		return combine_scalar;
+	}
+}
+
+void combine_points(float* out,
+	const float* start,
+	const float* base,
+	const float* const* others,
+	const float* weights,
+	int others_n,
+	size_t begin,
+	size_t end)
+{
+	static const CombineFunction combine = select_combine();
+	combine(out, start, base, others, weights, others_n, begin, end);
+}
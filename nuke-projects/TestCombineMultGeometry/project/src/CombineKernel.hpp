@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+// Floats combined at once; the block of the base and of the running sum
+// stay in L1 while the block of every input streams through.
+const size_t combine_block_size = 1024;
+
+// Writes out[k] = start[k] + sum_i weights[i] * (others[i][k] - base[k])
+// for k in [begin, end). out may be start or base itself, so inputs can be
+// combined in several batches onto the same out. A null base takes others
+// as deltas. Points are handled as flat xyz
+// float arrays. Picks the widest vector unit of the running CPU (AVX2+FMA,
+// NEON or plain C++). Has no DDImage dependency so it can be benchmarked
+// on its own.
+void combine_points(float* out,
+	const float* start,
+	const float* base,
+	const float* const* others,
+	const float* weights,
+	int others_n,
+	size_t begin,
+	size_t end);
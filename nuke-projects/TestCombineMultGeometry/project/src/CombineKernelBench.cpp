@@ -0,0 +1,59 @@
+// Headless timing of combine_points, built with -DBUILD_COMBINE_BENCH=ON.
+// Usage: CombineKernelBench [points] [inputs] [runs]
+
+#include "CombineKernel.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+	const size_t points_n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	const int inputs_n = argc > 2 ? std::atoi(argv[2]) : 10;
+	const int runs = argc > 3 ? std::atoi(argv[3]) : 20;
+	const size_t size = 3 * points_n;
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+	std::vector<float> base(size);
+	for (float& v : base)
+		v = value(random);
+	std::vector<std::vector<float>> others(inputs_n, std::vector<float>(size));
+	std::vector<const float*> other_data;
+	std::vector<float> weights;
+	for (std::vector<float>& other : others)
+	{
+		for (float& v : other)
+			v = value(random);
+		other_data.push_back(other.data());
+		weights.push_back(value(random));
+	}
+
+	std::vector<float> out(size);
+	double best = 1e30;
+	for (int run = 0; run < runs; run++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		combine_points(out.data(), base.data(), base.data(), other_data.data(), weights.data(), inputs_n, 0, size);
+		const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+
+	double max_error = 0;
+	for (size_t k = 0; k < size; k++)
+	{
+		double expected = base[k];
+		for (int i = 0; i < inputs_n; i++)
+			expected += double(weights[i]) * (double(others[i][k]) - base[k]);
+		max_error = std::max(max_error, std::fabs(expected - out[k]));
+	}
+
+	const double bytes = double(size) * sizeof(float) * (inputs_n + 2);
+	std::printf("%zu points x %d inputs: %.3f ms, %.1f GB/s, max error %g\n",
+		points_n, inputs_n, best, bytes / (best * 1e6), max_error);
+	return 0;
+}
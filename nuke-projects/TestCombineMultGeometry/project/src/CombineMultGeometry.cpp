@@ -1,25 +1,99 @@
 #include "CombineMultGeometry.hpp"
 
+#include "CombineKernel.hpp"
+#include "EigenPCA-master/pca.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
 #include <vector>
 
+// Share of moved points above which an input is blended densely.
+static const float max_sparse_fraction = 0.25f;
+
+// Dense inputs cooked and held at once, so memory does not grow with the
+// number of inputs.
+static const int dense_batch_size = 16;
+
+// Floats below which a pass is not worth spreading over threads.
+static const size_t parallel_size = 64 * combine_block_size;
+
+// Weight of every input in scripts saved before the per input knobs; the
+// legacy knob holds it until a script loads other values into it.
+static const float legacy_default = 0.5f;
+
 void CombineMultGeometry::_validate(bool for_real)
 {
 	Op* this_op = Op::input(0);
 
 	this_op->validate(for_real);
-	
-	for (int i = 1; i < N+1; i++)
+
+	// weights of an old script that were not moved to their knobs yet
+	for (int i = 1; i < legacy_N; i++)
 	{
-		if (Op::input(i) != nullptr)
-		{
-			Op* temp = Op::input(i);
-			temp->validate(for_real);
-		}
+		if (_legacy_param[i] != legacy_default)
+			_param[i - 1] = _legacy_param[i];
 	}
-	
+
+	// inputs with a zero weight are neither validated nor cooked, unless
+	// they are part of the compressed basis
+	for (int geo_id : _compress ? connected_inputs() : active_inputs())
+	{
+		Op* temp = Op::input(geo_id);
+		temp->validate(for_real);
+	}
+
+	_for_real = for_real;
 	GeoOp::_validate(for_real);
 }
 
+bool CombineMultGeometry::culling() const
+{
+	return _cull && _has_view && !_for_real;
+}
+
+void CombineMultGeometry::build_handles(ViewerContext* ctx)
+{
+	GeoOp::build_handles(ctx);
+	if (!_cull || ctx->transform_mode() == VIEWER_2D)
+		return;
+
+	// a new view changes the hash of a culled cook
+	const Matrix4 view = ctx->proj_matrix() * ctx->cam_matrix();
+	Guard guard(_view_lock);
+	if (_has_view && std::memcmp(view.array(), _view.array(), 16 * sizeof(float)) == 0)
+		return;
+	_view = view;
+	_has_view = true;
+	_view_generation++;
+	invalidate();
+	asapUpdate();
+}
+
+std::vector<int> CombineMultGeometry::active_inputs() const
+{
+	// unconnected inputs are skipped, input i takes _param[i-1]
+	std::vector<int> active;
+	for (int geo_id = 1; geo_id < N+1; ++geo_id)
+	{
+		if (Op::input(geo_id) != nullptr && _param[geo_id - 1] != 0)
+			active.push_back(geo_id);
+	}
+	return active;
+}
+
+std::vector<int> CombineMultGeometry::connected_inputs() const
+{
+	std::vector<int> connected;
+	for (int geo_id = 1; geo_id < N+1; ++geo_id)
+	{
+		if (Op::input(geo_id) != nullptr)
+			connected.push_back(geo_id);
+	}
+	return connected;
+}
+
 const char* CombineMultGeometry::Class() const
 {
 	return CLASS;
@@ -29,10 +103,23 @@ const char* CombineMultGeometry::node_help() const
 	return HELP;
 }
 
-CombineMultGeometry::CombineMultGeometry(Node* node) : GeoOp(node) {
+CombineMultGeometry::CombineMultGeometry(Node* node) : GeoOp(node), _param(N, 0.5f), _shown_groups(-1), input_deltas(N),
+	_compress(false), _variance_fraction(0.999f), _compression_rank(0), _compression_error(0),
+	_solved_rank(0), _solved_error(0),
+	_cull(false), _for_real(true), _has_view(false), _view_generation(0), _has_clusters(false) {
+	std::fill(_legacy_param, _legacy_param + legacy_N, legacy_default);
+	// knobs keep the label pointers, so the names live as long as the op
 	for (int i = 0; i < N; ++i)
 	{
-		_param[i] = 0.5f;
+		std::ostringstream name;
+		name << "combination param " << i + 1;
+		_param_names.push_back(name.str());
+	}
+	for (int i = 0; i < N; i += group_size)
+	{
+		std::ostringstream name;
+		name << "Inputs " << i + 1 << "-" << std::min(N, i + group_size);
+		_group_names.push_back(name.str());
 	}
 }
 
@@ -50,91 +137,690 @@ void CombineMultGeometry::get_geometry_hash()
 {
 	GeoOp::get_geometry_hash();
 
-	geo_hash[Group_Points].append(_param, N);
+	geo_hash[Group_Points].append(_param.data(), N);
+	for (int geo_id : _compress ? connected_inputs() : active_inputs())
+	{
+		geo_hash[Group_Points].append(input(geo_id)->hash(Group_Points));
+	}
+	if (culling())
+		geo_hash[Group_Points].append(_view_generation.load());
+	geo_hash[Group_Points].append(_compress);
+	geo_hash[Group_Points].append(_variance_fraction);
+}
+
+namespace {
+	// Bounds are kept as min x, y, z and max x, y, z. Starting them at zero
+	// covers the points a delta leaves where they are.
+	void expand_bounds(float* bounds, const Vector3& d)
+	{
+		bounds[0] = std::min(bounds[0], d.x);
+		bounds[1] = std::min(bounds[1], d.y);
+		bounds[2] = std::min(bounds[2], d.z);
+		bounds[3] = std::max(bounds[3], d.x);
+		bounds[4] = std::max(bounds[4], d.y);
+		bounds[5] = std::max(bounds[5], d.z);
+	}
+
+	// Writes a conservative bbox of base + sum weights[i] * delta_i from the
+	// base bbox and the bounds of every delta, without a pass over the
+	// points. Consumers wanting the exact bounds call update_bbox().
+	void set_blend_bbox(GeoInfo& info, const Box3& base, const std::vector<const float*>& bounds,
+		const std::vector<float>& weights)
+	{
+		float lo[3] = { base.min().x, base.min().y, base.min().z };
+		float hi[3] = { base.max().x, base.max().y, base.max().z };
+		for (size_t i = 0; i < bounds.size(); ++i)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				const float a = weights[i] * bounds[i][axis];
+				const float b = weights[i] * bounds[i][axis + 3];
+				lo[axis] += std::min(a, b);
+				hi[axis] += std::max(a, b);
+			}
+		}
+		info.bbox_.set(Vector3(lo[0], lo[1], lo[2]), Vector3(hi[0], hi[1], hi[2]));
+	}
+}
+
+void CombineMultGeometry::update_input_delta(InputDelta& delta, const std::vector<std::vector<float>>& base, const GeometryList& other)
+{
+	const unsigned int objs = static_cast<unsigned int>(base.size());
+	assert(objs == other.objects());
+
+	size_t points_n = 0;
+	size_t moved_n = 0;
+	delta.indices.assign(objs, std::vector<unsigned>());
+	delta.deltas.assign(objs, std::vector<Vector3>());
+	delta.bounds.assign(6 * objs, 0.0f);
+	for (unsigned int i = 0; i < objs; ++i)
+	{
+		const float* points = base[i].data();
+		const PointList* other_points = other[i].point_list();
+		const unsigned n = static_cast<unsigned>(base[i].size() / 3);
+		assert(n == other_points->size());
+		points_n += n;
+
+		float* bounds = &delta.bounds[6 * i];
+		for (unsigned j = 0; j < n; j++) {
+			const Vector3& other_v = (*other_points)[j];
+			const Vector3 d(other_v.x - points[3 * j], other_v.y - points[3 * j + 1], other_v.z - points[3 * j + 2]);
+			if (d.x != 0 || d.y != 0 || d.z != 0)
+			{
+				delta.indices[i].push_back(j);
+				delta.deltas[i].push_back(d);
+				expand_bounds(bounds, d);
+			}
+		}
+		moved_n += delta.indices[i].size();
+	}
+
+	delta.dense = moved_n > max_sparse_fraction * points_n;
+	if (delta.dense)
+	{
+		delta.indices.clear();
+		delta.deltas.clear();
+	}
+	delta.valid = true;
+}
+
+namespace {
+	struct CombineJob {
+		float* out;
+		const float* base;
+		const float* const* others;
+		const float* weights;
+		int others_n;
+		size_t size;
+	};
+
+	void combine_range(unsigned index, unsigned threads_n, void* data)
+	{
+		const CombineJob* job = static_cast<const CombineJob*>(data);
+		// whole kernel blocks per thread
+		const size_t blocks_n = (job->size + combine_block_size - 1) / combine_block_size;
+		const size_t begin = blocks_n * index / threads_n * combine_block_size;
+		const size_t end = std::min(job->size, blocks_n * (index + 1) / threads_n * combine_block_size);
+		if (begin < end)
+			combine_points(job->out, job->out, job->base, job->others, job->weights, job->others_n, begin, end);
+	}
+
+	// adds sum weights[i] * (others[i] - base) onto out
+	void combine(float* out, const float* base, const std::vector<const float*>& others,
+		const std::vector<float>& weights, size_t size)
+	{
+		CombineJob job = { out, base, others.data(), weights.data(), static_cast<int>(others.size()), size };
+		if (size < parallel_size || Thread::numThreads < 2)
+		{
+			combine_range(0, 1, &job);
+			return;
+		}
+		Thread::spawn(combine_range, Thread::numThreads, &job);
+		Thread::wait(&job);
+	}
+
+	struct ScatterJob {
+		Vector3* points;
+		unsigned points_n;
+		std::vector<const std::vector<unsigned>*> indices;
+		std::vector<const std::vector<Vector3>*> deltas;
+		std::vector<float> weights;
+	};
+
+	// Every thread owns a range of points and takes the part of each
+	// sorted index list falling into it, so no two threads write a point.
+	void scatter_range(unsigned index, unsigned threads_n, void* data)
+	{
+		const ScatterJob* job = static_cast<const ScatterJob*>(data);
+		const unsigned begin = static_cast<unsigned>(size_t(job->points_n) * index / threads_n);
+		const unsigned end = static_cast<unsigned>(size_t(job->points_n) * (index + 1) / threads_n);
+		for (size_t input = 0; input < job->indices.size(); input++)
+		{
+			const std::vector<unsigned>& indices = *job->indices[input];
+			const std::vector<Vector3>& deltas = *job->deltas[input];
+			const float w = job->weights[input];
+			const size_t k0 = std::lower_bound(indices.begin(), indices.end(), begin) - indices.begin();
+			const size_t k1 = std::lower_bound(indices.begin(), indices.end(), end) - indices.begin();
+			for (size_t k = k0; k < k1; k++) {
+				Vector3& v = job->points[indices[k]];
+				v.x += w * deltas[k].x;
+				v.y += w * deltas[k].y;
+				v.z += w * deltas[k].z;
+			}
+		}
+	}
+
+	// combine for a list of points only, as picked by culling
+	void combine_points_at(float* out, const float* base, const std::vector<const float*>& others,
+		const std::vector<float>& weights, const std::vector<unsigned>& points)
+	{
+		for (unsigned j : points)
+		{
+			const size_t k = 3 * size_t(j);
+			float sum[3] = { out[k], out[k + 1], out[k + 2] };
+			for (size_t i = 0; i < others.size(); i++)
+			{
+				for (int axis = 0; axis < 3; axis++)
+					sum[axis] += weights[i] * (others[i][k + axis] - base[k + axis]);
+			}
+			out[k] = sum[0];
+			out[k + 1] = sum[1];
+			out[k + 2] = sum[2];
+		}
+	}
+
+	void scatter(ScatterJob& job, size_t moved_n)
+	{
+		if (3 * moved_n < parallel_size || Thread::numThreads < 2)
+		{
+			scatter_range(0, 1, &job);
+			return;
+		}
+		Thread::spawn(scatter_range, Thread::numThreads, &job);
+		Thread::wait(&job);
+	}
 }
 
 void CombineMultGeometry::geometry_engine(Scene& scene, GeometryList& out)
 {
+	Guard guard(delta_lock);
+
 	input0()->get_geometry(scene, out);
 
 	unsigned int objs = out.objects();
 
-	std::vector<std::vector<Vector3>> neutral_points;
+	if (_compress)
+	{
+		if (!compression.valid || compression.key != compression_key())
+			update_compression(out);
+		// fewer than two inputs are not compressed
+		if (!compression.rows.empty())
+		{
+			combine_compressed(out);
+			return;
+		}
+	}
 
-	for (unsigned int i = 0; i < objs; ++i)
+	const std::vector<int> active = active_inputs();
+
+	// The base is copied aside only once some input has to be cooked: to
+	// compare against it, and because dense batches overwrite out.
+	std::vector<std::vector<float>> base;
+	auto copy_base = [&]() {
+		if (!base.empty() || objs == 0)
+			return;
+		base.resize(objs);
+		for (unsigned int i = 0; i < objs; ++i)
+		{
+			const PointList* points = out[i].point_list();
+			const float* data = points->empty() ? nullptr : &(*points)[0].x;
+			base[i].assign(data, data + 3 * points->size());
+		}
+	};
+	auto delta_key = [&](int geo_id) {
+		Hash key;
+		key.append(input0()->hash(Group_Points));
+		key.append(input(geo_id)->hash(Group_Points));
+		return key;
+	};
+
+	// Culling needs the bounds of every delta up front, so stale ones are
+	// refreshed first; a dense one is then cooked again in its batch.
+	std::vector<std::vector<unsigned>> visible;
+	if (culling())
 	{
-		GeoInfo& info = out[i];
-		const PointList* my_points = info.point_list();
-		const unsigned n = my_points->size();
+		for (int geo_id : active)
+		{
+			InputDelta& delta = input_deltas[geo_id - 1];
+			const Hash key = delta_key(geo_id);
+			if (delta.valid && delta.key == key)
+				continue;
 
-		std::vector<Vector3> my_vec;
-		
-		for (unsigned j = 0; j < n; j++) {
-			Vector3 vec;
-			const Vector3 v = (*my_points)[j];
-			vec.x = v.x;
-			vec.y = v.y;
-			vec.z = v.z;
-			my_vec.push_back(vec);
+			copy_base();
+			Scene other_scene;
+			GeometryList other;
+			input(geo_id)->get_geometry(other_scene, other);
+			assert(objs == other.objects());
+			update_input_delta(delta, base, other);
+			delta.key = key;
+		}
+
+		update_clusters(out);
+		Matrix4 view;
+		{
+			Guard view_guard(_view_lock);
+			view = _view;
+		}
+		visible.resize(objs);
+		for (unsigned int i = 0; i < objs; ++i)
+			visible[i] = visible_points(out[i], i, active, view);
+	}
+
+	// Inputs go in batches: cook the dense or stale ones, refresh stale
+	// deltas, add the dense ones onto out and let the batch go.
+	for (size_t batch0 = 0; batch0 < active.size(); batch0 += dense_batch_size)
+	{
+		const size_t batch1 = std::min(active.size(), batch0 + dense_batch_size);
+		std::vector<GeometryList> others(batch1 - batch0);
+		std::vector<const GeometryList*> dense;
+		std::vector<float> dense_weights;
+		for (size_t other_id = batch0; other_id < batch1; ++other_id)
+		{
+			const int geo_id = active[other_id];
+			InputDelta& delta = input_deltas[geo_id - 1];
+
+			const Hash key = delta_key(geo_id);
+			const bool stale = !delta.valid || delta.key != key;
+			if (!stale && !delta.dense)
+				continue;
+
+			copy_base();
+			GeometryList& other = others[other_id - batch0];
+			Scene other_scene;
+			input(geo_id)->get_geometry(other_scene, other);
+
+			unsigned int other_objs = other.objects();
+			assert(objs == other_objs);
+
+			if (stale)
+			{
+				update_input_delta(delta, base, other);
+				delta.key = key;
+			}
+			if (delta.dense)
+			{
+				dense.push_back(&other);
+				dense_weights.push_back(_param[geo_id - 1]);
+			}
+		}
+		if (dense.empty())
+			continue;
+
+		std::vector<const float*> other_points(dense.size());
+		for (unsigned int i = 0; i < objs; ++i)
+		{
+			PointList* points = out.writable_points(i);
+			const unsigned n = points->size();
+			if (n == 0)
+				continue;
+
+			for (size_t other_id = 0; other_id < dense.size(); ++other_id)
+			{
+				const PointList* other_list = (*dense[other_id])[i].point_list();
+				assert(n == other_list->size());
+				other_points[other_id] = &(*other_list)[0].x;
+			}
+			if (visible.empty())
+				combine(&(*points)[0].x, base[i].data(), other_points, dense_weights, 3 * size_t(n));
+			else
+				combine_points_at(&(*points)[0].x, base[i].data(), other_points, dense_weights, visible[i]);
 		}
-		neutral_points.push_back(my_vec);
 	}
 
+	// deltas are relative to the base, so they add onto the dense result
 	for (unsigned int i = 0; i < objs; ++i)
 	{
+		ScatterJob job;
+		size_t moved_n = 0;
+		for (int geo_id : active)
+		{
+			const InputDelta& delta = input_deltas[geo_id - 1];
+			if (delta.dense || delta.indices[i].empty())
+				continue;
+			job.indices.push_back(&delta.indices[i]);
+			job.deltas.push_back(&delta.deltas[i]);
+			job.weights.push_back(_param[geo_id - 1]);
+			moved_n += delta.indices[i].size();
+		}
+		if (job.indices.empty())
+			continue;
+
 		PointList* points = out.writable_points(i);
+		job.points = &(*points)[0];
+		job.points_n = points->size();
+		scatter(job, moved_n);
+	}
 
-		const unsigned n = points->size();
+	// out still holds the bbox of input 0
+	std::vector<const float*> bounds(active.size());
+	std::vector<float> weights(active.size());
+	for (unsigned int i = 0; i < objs; ++i)
+	{
+		for (size_t other_id = 0; other_id < active.size(); ++other_id)
+		{
+			bounds[other_id] = &input_deltas[active[other_id] - 1].bounds[6 * i];
+			weights[other_id] = _param[active[other_id] - 1];
+		}
+		set_blend_bbox(out[i], out[i].bbox(), bounds, weights);
+	}
+}
 
-		for (unsigned j = 0; j < n; j++) {
-			Vector3& v = (*points)[j];
-			const Vector3 orig_vec = neutral_points[i][j];
+void CombineMultGeometry::update_clusters(const GeometryList& base)
+{
+	Hash key;
+	key.append(input0()->hash(Group_Points));
+	key.append(base.objects());
+	if (_has_clusters && _clusters_key == key)
+		return;
 
-			v.x = orig_vec.x;
-			v.y = orig_vec.y;
-			v.z = orig_vec.z;
+	const unsigned int objs = base.objects();
+	_clusters.assign(objs, PointClusters());
+	_cluster_bounds.assign(objs, std::vector<float>());
+	for (unsigned int i = 0; i < objs; ++i)
+	{
+		const PointList* points = base[i].point_list();
+		if (points->empty())
+			continue;
+		build_clusters(&(*points)[0].x, points->size(), _clusters[i]);
+		cluster_bounds(_clusters[i], &(*points)[0].x, _cluster_bounds[i]);
+	}
+	_clusters_key = key;
+	_has_clusters = true;
+}
+
+std::vector<unsigned> CombineMultGeometry::visible_points(const GeoInfo& info, unsigned obj,
+	const std::vector<int>& active, const Matrix4& view) const
+{
+	// every point moves at most by the weighted delta bounds of the object
+	float margin[6] = { 0, 0, 0, 0, 0, 0 };
+	for (int geo_id : active)
+	{
+		const float w = _param[geo_id - 1];
+		const float* bounds = &input_deltas[geo_id - 1].bounds[6 * obj];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			margin[axis] += std::min(w * bounds[axis], w * bounds[axis + 3]);
+			margin[axis + 3] += std::max(w * bounds[axis], w * bounds[axis + 3]);
 		}
 	}
-	
-	for (int geo_id = 1; geo_id < N+1; ++geo_id)
+
+	const Frustum frustum = frustum_from_matrix((view * info.matrix).array());
+	const PointClusters& clusters = _clusters[obj];
+	const std::vector<float>& bounds = _cluster_bounds[obj];
+	std::vector<unsigned> points;
+	for (size_t c = 0; c < clusters.clusters(); c++)
+	{
+		float box[6];
+		for (int axis = 0; axis < 6; axis++)
+			box[axis] = bounds[6 * c + axis] + margin[axis];
+		if (!box_visible(frustum, box))
+			continue;
+		const size_t k0 = c * PointClusters::cluster_size;
+		const size_t k1 = std::min(clusters.order.size(), k0 + PointClusters::cluster_size);
+		points.insert(points.end(), clusters.order.begin() + k0, clusters.order.begin() + k1);
+	}
+	return points;
+}
+
+Hash CombineMultGeometry::compression_key() const
+{
+	Hash key;
+	key.append(input0()->hash(Group_Points));
+	for (int geo_id : connected_inputs())
+	{
+		key.append(geo_id);
+		key.append(input(geo_id)->hash(Group_Points));
+	}
+	key.append(_variance_fraction);
+	return key;
+}
+
+void CombineMultGeometry::update_compression(const GeometryList& base)
+{
+	compression = Compression();
+	compression.valid = true;
+	compression.key = compression_key();
+	{
+		Guard guard(_stats_lock);
+		_solved_rank = 0;
+		_solved_error = 0;
+	}
+
+	const std::vector<int> inputs = connected_inputs();
+	const unsigned int rows_n = static_cast<unsigned int>(inputs.size());
+	if (rows_n < 2)
+		return;
+
+	const unsigned int objs = base.objects();
+	std::vector<size_t> offsets(objs + 1, 0);
+	for (unsigned int i = 0; i < objs; ++i)
+		offsets[i + 1] = offsets[i] + 3 * size_t(base[i].points());
+	const size_t cols_n = offsets[objs];
+	if (cols_n < 2)
+		return;
+
+	// one row of deltas against the base per input, all objects in a row
+	std::vector<float> x(rows_n * cols_n);
+	for (unsigned int row = 0; row < rows_n; ++row)
 	{
-		if (Op::input(geo_id) == nullptr)
-			break;
-		
 		Scene other_scene;
 		GeometryList other;
-		input(geo_id)->get_geometry(other_scene, other);
-
-		unsigned int other_objs = other.objects();
-		assert(objs == other_objs);
+		input(inputs[row])->get_geometry(other_scene, other);
+		assert(objs == other.objects());
 
 		for (unsigned int i = 0; i < objs; ++i)
 		{
-			PointList* points = out.writable_points(i);
-			GeoInfo& other_info = other[i];
-			const PointList* other_points = other_info.point_list();
-
-			const unsigned n = points->size();
-			const unsigned other_n = other_points->size();
-			assert(n == other_n);
-			
-			for (unsigned j = 0; j < n; j++) {
-				Vector3& v = (*points)[j];
-				const Vector3& other_v = (*other_points)[j];
-				const Vector3 orig_vec = neutral_points[i][j];
-				
-				v.x += _param[geo_id] * (other_v.x - orig_vec.x);
-				v.y += _param[geo_id] * (other_v.y - orig_vec.y);
-				v.z += _param[geo_id] * (other_v.z - orig_vec.z);
+			const PointList* points = base[i].point_list();
+			const PointList* other_points = other[i].point_list();
+			assert(points->size() == other_points->size());
+			float* delta = &x[row * cols_n + offsets[i]];
+			for (unsigned j = 0; j < points->size(); j++) {
+				delta[3 * j] = (*other_points)[j].x - (*points)[j].x;
+				delta[3 * j + 1] = (*other_points)[j].y - (*points)[j].y;
+				delta[3 * j + 2] = (*other_points)[j].z - (*points)[j].z;
 			}
 		}
 	}
+
+	Pca pca;
+	if (pca.Calculate(x, rows_n, static_cast<unsigned int>(cols_n)) != 0)
+		return;
+
+	// the fewest components explaining the wanted share of the variance
+	const std::vector<float> var_props = pca.var_proportions();
+	int rank = 0;
+	float explained = 0;
+	while (rank < static_cast<int>(var_props.size()) && (rank == 0 || explained < _variance_fraction))
+		explained += var_props[rank++];
+
+	std::vector<std::vector<float>> components = pca.pca_components();
+	components.resize(rank);
+	compression.rows.push_back(pca.mean());
+	for (std::vector<float>& component : components)
+		compression.rows.push_back(std::move(component));
+	const std::vector<float>& mean = compression.rows[0];
+
+	// coefficients of every input and the largest point distance they leave
+	compression.coefficients.assign(size_t(rows_n) * rank, 0.0f);
+	std::vector<double> residual(cols_n);
+	float max_error = 0;
+	for (unsigned int row = 0; row < rows_n; ++row)
+	{
+		const float* delta = &x[row * cols_n];
+		for (size_t col = 0; col < cols_n; col++)
+			residual[col] = double(delta[col]) - mean[col];
+		for (int c = 0; c < rank; c++)
+		{
+			const std::vector<float>& component = compression.rows[c + 1];
+			double coefficient = 0;
+			for (size_t col = 0; col < cols_n; col++)
+				coefficient += residual[col] * component[col];
+			for (size_t col = 0; col < cols_n; col++)
+				residual[col] -= coefficient * component[col];
+			compression.coefficients[row * rank + c] = static_cast<float>(coefficient);
+		}
+		// columns come in xyz triples of one point
+		for (size_t col = 0; col < cols_n; col += 3)
+		{
+			const double distance = std::sqrt(residual[col] * residual[col] +
+				residual[col + 1] * residual[col + 1] + residual[col + 2] * residual[col + 2]);
+			max_error = std::max(max_error, static_cast<float>(distance));
+		}
+	}
+
+	// bounds of every row within every object for the output bbox
+	compression.bounds.assign(6 * objs * compression.rows.size(), 0.0f);
+	for (unsigned int i = 0; i < objs; ++i)
+	{
+		for (size_t row = 0; row < compression.rows.size(); ++row)
+		{
+			float* bounds = &compression.bounds[6 * (i * compression.rows.size() + row)];
+			const float* data = compression.rows[row].data() + offsets[i];
+			for (size_t k = 0; k < offsets[i + 1] - offsets[i]; k += 3)
+				expand_bounds(bounds, Vector3(data[k], data[k + 1], data[k + 2]));
+		}
+	}
+
+	compression.inputs = inputs;
+	compression.offsets = offsets;
+	{
+		Guard guard(_stats_lock);
+		_solved_rank = rank;
+		_solved_error = max_error;
+	}
+}
+
+void CombineMultGeometry::combine_compressed(GeometryList& out) const
+{
+	// sum w_i d_i = (sum w_i) mean + sum_c (sum_i w_i coefficient_ic) component_c
+	const size_t rows_n = compression.rows.size();
+	const size_t rank = rows_n - 1;
+	std::vector<float> weights(rows_n, 0.0f);
+	for (size_t row = 0; row < compression.inputs.size(); ++row)
+	{
+		const float w = _param[compression.inputs[row] - 1];
+		weights[0] += w;
+		for (size_t c = 0; c < rank; c++)
+			weights[c + 1] += w * compression.coefficients[row * rank + c];
+	}
+
+	std::vector<const float*> rows(rows_n);
+	std::vector<const float*> bounds(rows_n);
+	for (unsigned int i = 0; i < out.objects(); ++i)
+	{
+		for (size_t row = 0; row < rows_n; row++)
+			bounds[row] = &compression.bounds[6 * (i * rows_n + row)];
+		set_blend_bbox(out[i], out[i].bbox(), bounds, weights);
+
+		PointList* points = out.writable_points(i);
+		const unsigned n = points->size();
+		if (n == 0)
+			continue;
+		for (size_t row = 0; row < rows_n; row++)
+			rows[row] = compression.rows[row].data() + compression.offsets[i];
+		combine(&(*points)[0].x, nullptr, rows, weights, 3 * size_t(n));
+	}
 }
 
 void CombineMultGeometry::knobs(Knob_Callback f)
 {
-	MultiFloat_knob(f, _param, N,"combination param", "combination param");
-	SetRange(f, 0, 1);
+	Bool_knob(f, &_cull, "interactive culling", "Interactive Culling");
+	Tooltip(f, "In the viewer, blend dense inputs only where the result can be on screen. Renders blend every point.");
+
+	BeginClosedGroup(f, "Compression");
+	Bool_knob(f, &_compress, "compress inputs", "Compress Inputs");
+	Tooltip(f, "Blend the leading PCA components of the input deltas instead of every input");
+	Float_knob(f, &_variance_fraction, "variance fraction", "Variance Fraction");
+	SetRange(f, 0.9, 1);
+	Int_knob(f, &_compression_rank, "compression rank", "Components");
+	SetFlags(f, Knob::READ_ONLY | Knob::DO_NOT_WRITE | Knob::NO_RERENDER);
+	Float_knob(f, &_compression_error, "compression error", "Max Error");
+	SetFlags(f, Knob::READ_ONLY | Knob::DO_NOT_WRITE | Knob::NO_RERENDER);
+	Tooltip(f, "Largest distance of a point of any input from its reconstruction");
+	EndGroup(f);
+
+	for (int group = 0; group * group_size < N; group++)
+	{
+		BeginClosedGroup(f, _group_names[group].c_str());
+		const int end = std::min(N, (group + 1) * group_size);
+		for (int i = group * group_size; i < end; i++)
+		{
+			Float_knob(f, &_param[i], _param_names[i].c_str(), _param_names[i].c_str());
+			SetRange(f, 0, 1);
+		}
+		EndGroup(f);
+	}
+
+	MultiFloat_knob(f, _legacy_param, legacy_N, "combination param", "");
+	SetFlags(f, Knob::INVISIBLE | Knob::DO_NOT_WRITE | Knob::KNOB_CHANGED_ALWAYS);
+}
+
+int CombineMultGeometry::knob_changed(Knob* k)
+{
+	if (k->is("combination param"))
+	{
+		move_legacy_params(k);
+		return 1;
+	}
+	return GeoOp::knob_changed(k);
+}
+
+/*! Moves the weights an old script loaded into the legacy knob to the per
+input knobs: element i weighted input i, which is "combination param i" now.
+Element 0 was never used. Reads the knob, as knob_changed runs before the
+storage is written, and sets moved elements back to the default so that
+_validate stops applying them; the nested knob_changed this causes finds
+nothing left to move.
+*/
+void CombineMultGeometry::move_legacy_params(Knob* legacy)
+{
+	for (int i = 1; i < legacy_N; i++)
+	{
+		const float value = float(legacy->get_value(i));
+		if (value == legacy_default)
+			continue;
+		if (Knob* param_knob = knob(_param_names[i - 1].c_str()))
+			param_knob->set_value(value);
+		legacy->set_value(legacy_default, i);
+	}
+}
+
+bool CombineMultGeometry::updateUI(const OutputContext& context)
+{
+	// knob_changed may not run while a script loads
+	if (Knob* legacy = knob("combination param"))
+		move_legacy_params(legacy);
+
+	// one group for a lone base, then as many as the weights in use need
+	const int params_n = std::max(1, inputs() - 1);
+	show_groups((params_n + group_size - 1) / group_size);
+
+	// the cook only publishes the compression stats, the knobs are set here
+	// on the main thread
+	int rank;
+	float max_error;
+	{
+		Guard guard(_stats_lock);
+		rank = _solved_rank;
+		max_error = _solved_error;
+	}
+	Knob* rank_knob = knob("compression rank");
+	if (rank_knob && rank != _compression_rank)
+		rank_knob->set_value(rank);
+	Knob* error_knob = knob("compression error");
+	if (error_knob && max_error != _compression_error)
+		error_knob->set_value(max_error);
+	return GeoOp::updateUI(context);
+}
+
+void CombineMultGeometry::show_groups(int groups_n)
+{
+	if (groups_n == _shown_groups)
+		return;
+	_shown_groups = groups_n;
+
+	for (int group = 0; group * group_size < N; group++)
+	{
+		const bool visible = group < groups_n;
+		if (Knob* group_knob = knob(_group_names[group].c_str()))
+			group_knob->visible(visible);
+		const int end = std::min(N, (group + 1) * group_size);
+		for (int i = group * group_size; i < end; i++)
+		{
+			if (Knob* param_knob = knob(_param_names[i].c_str()))
+				param_knob->visible(visible);
+		}
+	}
 }
 
 static Op* build(Node* node)
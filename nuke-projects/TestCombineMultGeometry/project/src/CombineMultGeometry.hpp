@@ -4,8 +4,14 @@
 #include "DDImage/Scene.h"
 #include "DDImage/Knobs.h"
 #include "DDImage/ViewFrustum.h"
+#include "DDImage/ViewerContext.h"
+#include "DDImage/Thread.h"
+#include "nuke-practice/FrustumCull.hpp"
 
+#include <atomic>
 #include <cassert>
+#include <string>
+#include <vector>
 
 using namespace DD::Image;
 
@@ -15,8 +21,102 @@ static const char* const HELP = "Combine geometries of two objects";
 
 class CombineMultGeometry : public GeoOp
 {
-	static const int N = 10;
-	float _param[N];
+	// Up to N shapes; every input i > 0 has the weight _param[i-1], knobs
+	// come in closed groups of group_size. knobs() has to describe the same
+	// knobs every time, so all N weights exist and updateUI hides the groups
+	// past the connected inputs.
+	static const int N = 250;
+	static const int group_size = 10;
+	std::vector<float> _param;
+	std::vector<std::string> _param_names;
+	std::vector<std::string> _group_names;
+	int _shown_groups;
+
+	// The weights as scripts saved them before the per input knobs: input
+	// i took element i and element 0 went unused. Moved over to "combination
+	// param i" on the main thread, and applied to _param in _validate until
+	// then so that renders without a panel get them too.
+	static const int legacy_N = 10;
+	float _legacy_param[legacy_N];
+
+	// Points an input moves away from the base, kept per input while the
+	// input and base hashes stay the same so that unchanged inputs are not
+	// cooked again. Inputs moving over a quarter of the points stay dense.
+	struct InputDelta
+	{
+		bool valid = false;
+		Hash key;
+		bool dense = false;
+		std::vector<std::vector<unsigned>> indices;
+		std::vector<std::vector<Vector3>> deltas;
+		std::vector<float> bounds;
+	};
+	Lock delta_lock;
+	std::vector<InputDelta> input_deltas;
+
+	// Optional PCA of the connected inputs' deltas, kept while the input
+	// hashes stay the same. The blend then adds the mean delta and the k
+	// leading components instead of every input.
+	struct Compression
+	{
+		bool valid = false;
+		Hash key;
+		std::vector<int> inputs;
+		std::vector<size_t> offsets;
+		std::vector<std::vector<float>> rows;
+		std::vector<float> coefficients;
+		std::vector<float> bounds;
+	};
+	bool _compress;
+	float _variance_fraction;
+	int _compression_rank;
+	float _compression_error;
+	Compression compression;
+
+	// Rank and error of the last compression, handed from the cook to
+	// updateUI which shows them in the read only knobs above.
+	Lock _stats_lock;
+	int _solved_rank;
+	float _solved_error;
+
+	// Interactive culling: the viewer matrix seen in build_handles picks
+	// the clusters of base points whose blended bounds can be on screen,
+	// only those are blended by dense inputs. Cooks validated for_real
+	// blend every point.
+	bool _cull;
+	bool _for_real;
+	// _view is written under _view_lock; the flag and the generation are
+	// also read by get_geometry_hash, so they are atomic
+	Lock _view_lock;
+	std::atomic<bool> _has_view;
+	Matrix4 _view;
+	std::atomic<unsigned> _view_generation;
+	bool _has_clusters;
+	Hash _clusters_key;
+	std::vector<PointClusters> _clusters;
+	std::vector<std::vector<float>> _cluster_bounds;
+
+	std::vector<int> active_inputs() const;
+
+	bool culling() const;
+
+	void update_clusters(const GeometryList& base);
+
+	std::vector<unsigned> visible_points(const GeoInfo& info, unsigned obj, const std::vector<int>& active, const Matrix4& view) const;
+
+	std::vector<int> connected_inputs() const;
+
+	Hash compression_key() const;
+
+	void update_compression(const GeometryList& base);
+
+	void combine_compressed(GeometryList& out) const;
+
+	void show_groups(int groups_n);
+
+	void move_legacy_params(Knob* legacy);
+
+	static void update_input_delta(InputDelta& delta, const std::vector<std::vector<float>>& base, const GeometryList& other);
 	
 protected:
 	void _validate(bool for_real) override;
@@ -36,4 +136,10 @@ public:
 	void geometry_engine(Scene& scene, GeometryList& out) override;
 
 	void knobs(Knob_Callback f) override;
+
+	int knob_changed(Knob* k) override;
+
+	bool updateUI(const OutputContext& context) override;
+
+	void build_handles(ViewerContext* ctx) override;
 };
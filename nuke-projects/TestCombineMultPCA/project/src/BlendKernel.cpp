@@ -0,0 +1,170 @@
+#include "BlendKernel.hpp"
+
+#include "nuke-practice/CpuFeatures.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(CPU_FEATURES_X86)
+#define BLEND_X86
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define BLEND_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+    typedef void (*BlendFunction)(float*, const float*, const float* const*, const float*, int, size_t, size_t);
+
+    // Every kernel walks [begin, end) in blocks: the block of out is set to
+    // the mean (if any) and then receives the deltas two components at a
+    // time, so it stays in L1 while the delta rows stream through.
+
+    void blend_scalar(float* out, const float* mean, const float* const* deltas,
+        const float* weights, int components_n, size_t begin, size_t end)
+    {
+        for (size_t b0 = begin; b0 < end; b0 += blend_block_size)
+        {
+            const size_t b1 = std::min(end, b0 + blend_block_size);
+            if (mean)
+                std::memcpy(out + b0, mean + b0, (b1 - b0) * sizeof(float));
+
+            int c = 0;
+            for (; c + 1 < components_n; c += 2)
+            {
+                const float w0 = weights[c];
+                const float w1 = weights[c + 1];
+                const float* d0 = deltas[c];
+                const float* d1 = deltas[c + 1];
+                for (size_t k = b0; k < b1; k++)
+                    out[k] += w0 * d0[k] + w1 * d1[k];
+            }
+            if (c < components_n)
+            {
+                const float w0 = weights[c];
+                const float* d0 = deltas[c];
+                for (size_t k = b0; k < b1; k++)
+                    out[k] += w0 * d0[k];
+            }
+        }
+    }
+
+#ifdef BLEND_X86
+    CPU_TARGET_AVX2
+    void blend_avx2(float* out, const float* mean, const float* const* deltas,
+        const float* weights, int components_n, size_t begin, size_t end)
+    {
+        for (size_t b0 = begin; b0 < end; b0 += blend_block_size)
+        {
+            const size_t b1 = std::min(end, b0 + blend_block_size);
+            if (mean)
+                std::memcpy(out + b0, mean + b0, (b1 - b0) * sizeof(float));
+
+            int c = 0;
+            for (; c + 1 < components_n; c += 2)
+            {
+                const __m256 w0 = _mm256_set1_ps(weights[c]);
+                const __m256 w1 = _mm256_set1_ps(weights[c + 1]);
+                const float* d0 = deltas[c];
+                const float* d1 = deltas[c + 1];
+                size_t k = b0;
+                for (; k + 8 <= b1; k += 8)
+                {
+                    __m256 acc = _mm256_loadu_ps(out + k);
+                    acc = _mm256_fmadd_ps(w0, _mm256_loadu_ps(d0 + k), acc);
+                    acc = _mm256_fmadd_ps(w1, _mm256_loadu_ps(d1 + k), acc);
+                    _mm256_storeu_ps(out + k, acc);
+                }
+                for (; k < b1; k++)
+                    out[k] += weights[c] * d0[k] + weights[c + 1] * d1[k];
+            }
+            if (c < components_n)
+            {
+                const __m256 w0 = _mm256_set1_ps(weights[c]);
+                const float* d0 = deltas[c];
+                size_t k = b0;
+                for (; k + 8 <= b1; k += 8)
+                {
+                    const __m256 acc = _mm256_loadu_ps(out + k);
+                    _mm256_storeu_ps(out + k, _mm256_fmadd_ps(w0, _mm256_loadu_ps(d0 + k), acc));
+                }
+                for (; k < b1; k++)
+                    out[k] += weights[c] * d0[k];
+            }
+        }
+    }
+#endif
+
+#ifdef BLEND_NEON
+    void blend_neon(float* out, const float* mean, const float* const* deltas,
+        const float* weights, int components_n, size_t begin, size_t end)
+    {
+        for (size_t b0 = begin; b0 < end; b0 += blend_block_size)
+        {
+            const size_t b1 = std::min(end, b0 + blend_block_size);
+            if (mean)
+                std::memcpy(out + b0, mean + b0, (b1 - b0) * sizeof(float));
+
+            for (int c = 0; c < components_n; c++)
+            {
+                const float32x4_t w0 = vdupq_n_f32(weights[c]);
+                const float* d0 = deltas[c];
+                size_t k = b0;
+                for (; k + 4 <= b1; k += 4)
+                    vst1q_f32(out + k, vmlaq_f32(vld1q_f32(out + k), w0, vld1q_f32(d0 + k)));
+                for (; k < b1; k++)
+                    out[k] += weights[c] * d0[k];
+            }
+        }
+    }
+#endif
+
+    BlendFunction select_blend()
+    {
+#if defined(BLEND_X86)
+        if (cpu_level() >= Cpu_AVX2)
+            return blend_avx2;
+#elif defined(BLEND_NEON)
+        return blend_neon;
+#endif
+        return blend_scalar;
+    }
+}
+
+void blend_components(float* out,
+    const float* mean,
+    const float* const* deltas,
+    const float* weights,
+    int components_n,
+    size_t begin,
+    size_t end)
+{
+    static const BlendFunction blend = select_blend();
+    blend(out, mean, deltas, weights, components_n, begin, end);
+}
+
+size_t frames_block_size(int components_n)
+{
+    // delta and mean blocks together within half of a typical 1MB L2
+    const size_t cache_floats = (512 * 1024) / sizeof(float);
+    const size_t block = cache_floats / (components_n + 1);
+    const size_t min_block = 256;
+    return std::max(min_block, std::min(blend_block_size, block / min_block * min_block));
+}
+
+void blend_frames(float* const* outs,
+    const float* mean,
+    const float* const* deltas,
+    const float* weights,
+    int frames_n,
+    int components_n,
+    size_t begin,
+    size_t end)
+{
+    const size_t block = frames_block_size(components_n);
+    for (size_t b0 = begin; b0 < end; b0 += block)
+    {
+        const size_t b1 = std::min(end, b0 + block);
+        for (int f = 0; f < frames_n; f++)
+            blend_components(outs[f], mean, deltas, weights + static_cast<size_t>(f) * components_n, components_n, b0, b1);
+    }
+}
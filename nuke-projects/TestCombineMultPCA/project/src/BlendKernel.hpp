@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Allocator giving cache line aligned storage, so that rows of component
+// deltas start on a vector boundary.
+template <class T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    static const size_t alignment = 64;
+
+    AlignedAllocator() {}
+
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+#ifdef _WIN32
+        void* ptr = _aligned_malloc(n * sizeof(T), alignment);
+#else
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, alignment, n * sizeof(T)) != 0)
+            ptr = nullptr;
+#endif
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t)
+    {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    template <class U>
+    struct rebind { typedef AlignedAllocator<U> other; };
+};
+
+template <class T, class U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+
+template <class T, class U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+typedef std::vector<float, AlignedAllocator<float>> AlignedFloats;
+
+// Rounds a row length up so consecutive rows of an AlignedFloats stay aligned.
+inline size_t aligned_row_size(size_t size)
+{
+    const size_t floats_per_line = AlignedAllocator<float>::alignment / sizeof(float);
+    return (size + floats_per_line - 1) / floats_per_line * floats_per_line;
+}
+
+// Floats the blend works on at once; output, mean and one block of every
+// delta row fit into L2 together.
+const size_t blend_block_size = 2048;
+
+// Writes out[k] = mean[k] + sum_i weights[i] * deltas[i][k] for k in
+// [begin, end). With a null mean the deltas are added onto out instead.
+// Points are handled as flat xyz float arrays. Picks the widest vector
+// unit of the running CPU (AVX2+FMA, NEON or plain C++).
+void blend_components(float* out,
+    const float* mean,
+    const float* const* deltas,
+    const float* weights,
+    int components_n,
+    size_t begin,
+    size_t end);
+
+// Blends frames_n weight vectors at once: outs[f] = mean + sum_i
+// weights[f * components_n + i] * deltas[i]. Point blocks are sized so the
+// block of every delta row stays in cache while all frames are written.
+void blend_frames(float* const* outs,
+    const float* mean,
+    const float* const* deltas,
+    const float* weights,
+    int frames_n,
+    int components_n,
+    size_t begin,
+    size_t end);
+
+// Block of floats blend_frames works on for a given component count,
+// never larger than blend_block_size.
+size_t frames_block_size(int components_n);
@@ -1,5 +1,10 @@
 #include "CombineMultPCA.hpp"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <sstream>
 #include <vector>
 
 using namespace DD::Image;
@@ -7,12 +12,35 @@ using namespace DD::Image;
 namespace {
     const char* const CLASS = "CombineMultPCA";
     const char* const HELP = "Combine geometries of two objects";
+
+    // Incremental updates between two full blends, and the bound on their
+    // accumulated rounding error relative to the model size.
+    const int max_incremental_updates = 64;
+    const float max_relative_blend_error = 1e-6f;
+
+    const int max_components = 300;
+    const int component_group_size = 10;
 }
 
 void CombineMultPCA::_validate(bool for_real)
 {
     Op* this_op = Op::input(0);
     this_op->validate(for_real);
+
+    {
+        Guard guard(basis_lock);
+        model.reset();
+        if (model_file && *model_file)
+        {
+            std::string model_error;
+            model = open_model_file(model_file, model_error);
+            if (!model)
+            {
+                error("%s", model_error.c_str());
+                return;
+            }
+        }
+    }
     GeoOp::_validate(for_real);
 }
 
@@ -28,14 +56,39 @@ const char* CombineMultPCA::node_help() const
 
 CombineMultPCA::CombineMultPCA(Node* node):
     GeoOp(node),
-    pca_N(10),
+    pca_N(max_components),
     points_n(0),
     obj_n(0),
-    params(new float[pca_N])
+    params(pca_N, 0.0f),
+    shown_components(-1),
+    has_basis(false),
+    basis_row_size(0),
+    model_scale(0),
+    has_object(false),
+    model_file(nullptr),
+    has_blend(false),
+    incremental_updates(0),
+    blend_error(0),
+    cache_frames(false),
+    cache_first_frame(1),
+    cache_last_frame(100),
+    cache_memory(1024)
 {
+    // knobs keep the label pointers, so the names live as long as the op.
+    // The first weight keeps the name every weight had before, so older
+    // scripts still load it.
     for (int i = 0; i < pca_N; i++)
     {
-        params[i] = 0;
+        std::ostringstream name;
+        name << "combination param " << i + 1;
+        param_labels.push_back(name.str());
+        param_names.push_back(i == 0 ? "combination param" : name.str());
+    }
+    for (int i = 0; i < pca_N; i += component_group_size)
+    {
+        std::ostringstream name;
+        name << "Components " << i + 1 << "-" << std::min(pca_N, i + component_group_size);
+        group_names.push_back(name.str());
     }
 }
 
@@ -52,64 +105,586 @@ int CombineMultPCA::maximum_inputs() const
 void CombineMultPCA::get_geometry_hash()
 {
     GeoOp::get_geometry_hash();
-    geo_hash[Group_Points].append(params, pca_N);
+    geo_hash[Group_Points].append(params.data(), pca_N);
+    if (model)
+    {
+        const Hash key = input_hash();
+        geo_hash[Group_Points].append(key);
+        geo_hash[Group_Primitives].append(key);
+    }
+}
+
+Hash CombineMultPCA::input_hash() const
+{
+    Hash key;
+    if (model)
+    {
+        key.append(model_file);
+        key.append(model->stamp());
+        return key;
+    }
+    key.append(input0()->hash(Group_Points));
+    key.append(input0()->hash(Group_Primitives));
+    return key;
+}
+
+Hash CombineMultPCA::object_hash() const
+{
+    // the output object is a copy of the first input object, whose matrix
+    // and attributes can change while the basis stays the same
+    Hash key = input_hash();
+    if (!model)
+    {
+        key.append(input0()->hash(Group_Matrix));
+        key.append(input0()->hash(Group_Attributes));
+    }
+    return key;
 }
 
 void CombineMultPCA::geometry_engine(Scene& scene, GeometryList& out)
 {
+    {
+        Guard guard(basis_lock);
+
+        const Hash key = input_hash();
+        const bool basis_valid = has_basis && basis_hash == key;
+        if (basis_valid && has_object && object_key == object_hash() && !rebuild(Mask_Primitives)
+            && out.objects() == 1 && out[0].points() == points_n)
+        {
+            // only params changed, the output object is still up to date
+            combine_pca(*out.writable_points(0));
+            set_output_bbox(out[0]);
+            return;
+        }
+
+        if (model)
+        {
+            if (!basis_valid)
+            {
+                update_model_basis();
+                basis_hash = key;
+                has_basis = true;
+            }
+            build_model_object(out);
+            object_key = object_hash();
+            has_object = true;
+            combine_pca(*out.writable_points(0));
+            set_output_bbox(out[0]);
+            return;
+        }
+    }
+
+    // cooked without the lock, so other cooks of this op are not held up
+    // by the upstream geometry
     GeometryList in;
     {
         Scene in_scene;
         input0()->get_geometry(scene, in);
     }
+
+    Guard guard(basis_lock);
+    const Hash key = input_hash();
     obj_n = in.objects();
-    assert(obj_n > 0 && obj_n <= pca_N+1);
+    if (obj_n == 0)
+    {
+        error("Input has no objects");
+        return;
+    }
+    if (obj_n > pca_N + 1)
+    {
+        warning("Only the first %d of %d components are blended", pca_N, obj_n - 1);
+        obj_n = pca_N + 1;
+    }
 
     points_n = in[0].points();
-    assert(points_n > 0);
+    if (points_n == 0)
+    {
+        error("Input mean object has no points");
+        return;
+    }
 
-    combine_pca(out, in);
-}
+    if (!has_basis || basis_hash != key)
+    {
+        update_basis(in);
+        basis_hash = key;
+        has_basis = true;
+    }
 
-void CombineMultPCA::combine_pca(GeometryList& out, const GeometryList& in) const
-{
-    const GeoInfo* info_to_copy = &in[0];
-    
     out.delete_objects();
     out.add_object(0);
-    out[0].copy(info_to_copy);
-    PointList* out_points = out.writable_points(0);
+    out[0].copy(&in[0]);
+    object_key = object_hash();
+    has_object = true;
+    combine_pca(*out.writable_points(0));
+    set_output_bbox(out[0]);
+}
 
-    const GeoInfo& mean_info = in[0];
-    const PointList* mean_points = mean_info.point_list();
+namespace {
+    // Floats below which a blend is not worth spreading over threads.
+    const size_t parallel_blend_size = 64 * blend_block_size;
 
-    for (unsigned int j = 0; j < points_n; j++) {
-        (*out_points)[j] = (*mean_points)[j];
+    float* point_data(PointList& points)
+    {
+        static_assert(sizeof(Vector3) == 3 * sizeof(float), "points are used as flat xyz arrays");
+        return &points[0].x;
+    }
+
+    const float* point_data(const PointList& points)
+    {
+        return &points[0].x;
     }
 
+    // Per axis minimum and maximum of flat xyz data, as min x, y, z and
+    // max x, y, z.
+    void point_bounds(const float* data, size_t size, float* bounds)
+    {
+        for (int axis = 0; axis < 3; axis++) {
+            bounds[axis] = size > 0 ? FLT_MAX : 0;
+            bounds[axis + 3] = size > 0 ? -FLT_MAX : 0;
+        }
+        for (size_t k = 0; k < size; k += 3) {
+            for (int axis = 0; axis < 3; axis++) {
+                bounds[axis] = std::min(bounds[axis], data[k + axis]);
+                bounds[axis + 3] = std::max(bounds[axis + 3], data[k + axis]);
+            }
+        }
+    }
+
+    // Writes a conservative bbox of mean + sum weights[i] * delta_i from
+    // the bounds of the mean and of every delta, without a pass over the
+    // points. Consumers wanting the exact bounds call update_bbox().
+    void set_blend_bbox(GeoInfo& info, const float* mean_bounds, const float* delta_bounds,
+        const float* weights, int deltas_n)
+    {
+        float lo[3] = { mean_bounds[0], mean_bounds[1], mean_bounds[2] };
+        float hi[3] = { mean_bounds[3], mean_bounds[4], mean_bounds[5] };
+        for (int i = 0; i < deltas_n; i++) {
+            const float w = weights[i];
+            if (w == 0)
+                continue;
+            const float* bounds = delta_bounds + 6 * i;
+            for (int axis = 0; axis < 3; axis++) {
+                const float a = w * bounds[axis];
+                const float b = w * bounds[axis + 3];
+                lo[axis] += std::min(a, b);
+                hi[axis] += std::max(a, b);
+            }
+        }
+        info.bbox_.set(Vector3(lo[0], lo[1], lo[2]), Vector3(hi[0], hi[1], hi[2]));
+    }
+
+    struct BlendJob {
+        float* out;
+        const float* mean;
+        const float* const* deltas;
+        const float* weights;
+        int components_n;
+        size_t size;
+    };
+
+    void blend_range(unsigned index, unsigned threads_n, void* data)
+    {
+        const BlendJob* job = static_cast<const BlendJob*>(data);
+        // whole kernel blocks per thread
+        const size_t blocks_n = (job->size + blend_block_size - 1) / blend_block_size;
+        const size_t begin = blocks_n * index / threads_n * blend_block_size;
+        const size_t end = std::min(job->size, blocks_n * (index + 1) / threads_n * blend_block_size);
+        if (begin < end)
+        {
+            blend_components(job->out, job->mean, job->deltas, job->weights, job->components_n, begin, end);
+        }
+    }
+
+    void blend(float* out, const float* mean, const std::vector<const float*>& deltas,
+        const std::vector<float>& weights, size_t size)
+    {
+        BlendJob job = { out, mean, deltas.data(), weights.data(), static_cast<int>(deltas.size()), size };
+        if (size < parallel_blend_size || Thread::numThreads < 2)
+        {
+            blend_range(0, 1, &job);
+            return;
+        }
+        Thread::spawn(blend_range, Thread::numThreads, &job);
+        Thread::wait(&job);
+    }
+
+    struct FramesJob {
+        float* const* outs;
+        const float* mean;
+        const float* const* deltas;
+        const float* weights;
+        int frames_n;
+        int components_n;
+        size_t size;
+    };
+
+    void blend_frames_range(unsigned index, unsigned threads_n, void* data)
+    {
+        const FramesJob* job = static_cast<const FramesJob*>(data);
+        const size_t block = frames_block_size(job->components_n);
+        const size_t blocks_n = (job->size + block - 1) / block;
+        const size_t begin = blocks_n * index / threads_n * block;
+        const size_t end = std::min(job->size, blocks_n * (index + 1) / threads_n * block);
+        if (begin < end)
+        {
+            blend_frames(job->outs, job->mean, job->deltas, job->weights, job->frames_n, job->components_n, begin, end);
+        }
+    }
+
+    // weights holds one row of deltas.size() weights per output
+    void blend_batch(const std::vector<float*>& outs, const float* mean,
+        const std::vector<const float*>& deltas, const std::vector<float>& weights, size_t size)
+    {
+        FramesJob job = { outs.data(), mean, deltas.data(), weights.data(),
+            static_cast<int>(outs.size()), static_cast<int>(deltas.size()), size };
+        if (size * outs.size() < parallel_blend_size || Thread::numThreads < 2)
+        {
+            blend_frames_range(0, 1, &job);
+            return;
+        }
+        Thread::spawn(blend_frames_range, Thread::numThreads, &job);
+        Thread::wait(&job);
+    }
+}
+
+void CombineMultPCA::update_basis(const GeometryList& in)
+{
+    const float* mean = point_data(*in[0].point_list());
+    const size_t size = 3 * static_cast<size_t>(points_n);
+    basis_row_size = aligned_row_size(size);
+
+    mean_points.assign(mean, mean + size);
+    basis.resize(basis_row_size * (obj_n - 1));
     for (int obj_id = 1; obj_id < obj_n; obj_id++) {
         const GeoInfo& other_info = in[obj_id];
         const PointList* other_points = other_info.point_list();
         assert(points_n == other_points->size());
 
-        for (unsigned int j = 0; j < points_n; j++) {
-            (*out_points)[j] += ((*other_points)[j] - (*mean_points)[j]) * params[obj_id-1];
+        const float* other = point_data(*other_points);
+        float* delta = &basis[basis_row_size * (obj_id - 1)];
+        for (size_t k = 0; k < size; k++) {
+            delta[k] = other[k] - mean[k];
+        }
+    }
+
+    update_extents();
+    reset_blend_state();
+}
+
+void CombineMultPCA::update_model_basis()
+{
+    const ModelFileHeader& header = model->header();
+    points_n = header.points_n;
+    obj_n = static_cast<int>(std::min<uint32_t>(header.components_n, pca_N)) + 1;
+
+    // the mapped rows are the basis, only their extents are computed here
+    mean_points.clear();
+    basis.clear();
+
+    update_extents();
+    reset_blend_state();
+}
+
+void CombineMultPCA::update_extents()
+{
+    const size_t size = 3 * static_cast<size_t>(points_n);
+    point_bounds(mean_row(), size, mean_bounds);
+    delta_bounds.resize(6 * (obj_n - 1));
+    delta_extents.assign(obj_n - 1, 0.0f);
+
+    model_scale = 0;
+    for (int axis = 0; axis < 6; axis++) {
+        model_scale = std::max(model_scale, std::fabs(mean_bounds[axis]));
+    }
+    for (int component = 0; component < obj_n - 1; component++) {
+        float* bounds = &delta_bounds[6 * component];
+        point_bounds(delta_row(component), size, bounds);
+        float extent = 0;
+        for (int axis = 0; axis < 6; axis++) {
+            extent = std::max(extent, std::fabs(bounds[axis]));
         }
+        delta_extents[component] = extent;
+        model_scale = std::max(model_scale, extent);
     }
 }
 
+void CombineMultPCA::set_output_bbox(GeoInfo& info) const
+{
+    set_blend_bbox(info, mean_bounds, delta_bounds.data(), params.data(), obj_n - 1);
+}
+
+void CombineMultPCA::build_model_object(GeometryList& out) const
+{
+    const ModelFileHeader& header = model->header();
+    out.delete_objects();
+    out.add_object(0);
+    out.writable_points(0)->resize(points_n);
+
+    const uint32_t* face_sizes = model->face_sizes();
+    const uint32_t* face_points = model->face_points();
+    for (uint32_t face = 0; face < header.faces_n; face++)
+    {
+        Polygon* polygon = new Polygon(face_sizes[face], true);
+        for (uint32_t v = 0; v < face_sizes[face]; v++)
+        {
+            polygon->vertex(v) = *face_points++;
+        }
+        out.add_primitive(0, polygon);
+    }
+}
+
+void CombineMultPCA::reset_blend_state()
+{
+    has_blend = false;
+    blend_points.resize(3 * static_cast<size_t>(points_n));
+    clear_frame_cache();
+}
+
+const float* CombineMultPCA::mean_row() const
+{
+    return model ? model->mean() : mean_points.data();
+}
+
+const float* CombineMultPCA::delta_row(int component) const
+{
+    return model ? model->delta(component) : &basis[basis_row_size * component];
+}
+
+bool CombineMultPCA::update_blend_incrementally()
+{
+    if (!has_blend || incremental_updates >= max_incremental_updates)
+        return false;
+
+    std::vector<const float*> deltas;
+    std::vector<float> weight_changes;
+    size_t active_n = 0;
+    float error = blend_error;
+    for (int obj_id = 1; obj_id < obj_n; obj_id++) {
+        if (params[obj_id-1] != 0)
+            active_n++;
+        const float weight_change = params[obj_id-1] - blend_params[obj_id-1];
+        if (weight_change != 0) {
+            deltas.push_back(delta_row(obj_id - 1));
+            weight_changes.push_back(weight_change);
+            error += std::fabs(weight_change) * delta_extents[obj_id - 1] * FLT_EPSILON;
+        }
+    }
+
+    // a full blend costs the mean plus one pass per active component
+    if (deltas.size() > active_n || error > max_relative_blend_error * model_scale)
+        return false;
+
+    if (!deltas.empty()) {
+        blend(blend_points.data(), nullptr, deltas, weight_changes, 3 * static_cast<size_t>(points_n));
+        incremental_updates++;
+        blend_error = error;
+        blend_params.assign(params.begin(), params.begin() + obj_n - 1);
+    }
+    return true;
+}
+
+void CombineMultPCA::combine_pca(PointList& out_points)
+{
+    const size_t size = 3 * static_cast<size_t>(points_n);
+
+    if (cache_frames)
+    {
+        if (load_cached_frame(out_points))
+            return;
+        const int frame = static_cast<int>(outputContext().frame());
+        if (frame >= cache_first_frame && frame <= cache_last_frame)
+        {
+            bake_frames(frame);
+            if (load_cached_frame(out_points))
+                return;
+        }
+    }
+
+    if (!update_blend_incrementally()) {
+        // components with a zero weight do not move any point
+        std::vector<const float*> deltas;
+        std::vector<float> weights;
+        for (int obj_id = 1; obj_id < obj_n; obj_id++) {
+            if (params[obj_id-1] != 0) {
+                deltas.push_back(delta_row(obj_id - 1));
+                weights.push_back(params[obj_id-1]);
+            }
+        }
+
+        blend(blend_points.data(), mean_row(), deltas, weights, size);
+        blend_params.assign(params.begin(), params.begin() + obj_n - 1);
+        has_blend = true;
+        incremental_updates = 0;
+        blend_error = 0;
+    }
+
+    std::memcpy(point_data(out_points), blend_points.data(), size * sizeof(float));
+}
+
+Hash CombineMultPCA::frame_key(const float* weights) const
+{
+    Hash key;
+    key.append(basis_hash);
+    key.append(weights, obj_n - 1);
+    return key;
+}
+
+size_t CombineMultPCA::cache_budget() const
+{
+    return static_cast<size_t>(std::max(0.0f, cache_memory) * 1024 * 1024);
+}
+
+bool CombineMultPCA::load_cached_frame(PointList& out_points)
+{
+    const auto found = frame_index.find(frame_key(params.data()).value());
+    if (found == frame_index.end())
+        return false;
+
+    frame_cache.splice(frame_cache.begin(), frame_cache, found->second);
+    const AlignedFloats& points = found->second->points;
+    std::memcpy(point_data(out_points), points.data(), points.size() * sizeof(float));
+    return true;
+}
+
+void CombineMultPCA::bake_frames(int first_frame)
+{
+    const size_t size = 3 * static_cast<size_t>(points_n);
+    const int params_n = obj_n - 1;
+    const size_t frame_bytes = size * sizeof(float);
+    const size_t frames_max = cache_budget() / frame_bytes;
+    if (frames_max == 0)
+        return;
+
+    // Weights of the frames from first_frame on that are not cached yet,
+    // as many as the budget holds. Held keys are baked once.
+    std::vector<float> frame_params;
+    std::vector<Hash> keys;
+    std::vector<float> weights(params_n);
+    for (int frame = first_frame; frame <= cache_last_frame && keys.size() < frames_max; frame++)
+    {
+        for (int i = 0; i < params_n; i++)
+        {
+            Knob* param_knob = knob(param_names[i].c_str());
+            weights[i] = param_knob ? static_cast<float>(param_knob->get_value_at(frame)) : params[i];
+        }
+        const Hash key = frame_key(weights.data());
+        if (frame_index.count(key.value()))
+            continue;
+        if (std::find(keys.begin(), keys.end(), key) != keys.end())
+            continue;
+        keys.push_back(key);
+        frame_params.insert(frame_params.end(), weights.begin(), weights.end());
+    }
+    if (keys.empty())
+        return;
+
+    // only components animated away from zero somewhere in the range
+    std::vector<int> active;
+    for (int i = 0; i < params_n; i++)
+    {
+        for (size_t f = 0; f < keys.size(); f++)
+        {
+            if (frame_params[f * params_n + i] != 0)
+            {
+                active.push_back(i);
+                break;
+            }
+        }
+    }
+    std::vector<const float*> deltas;
+    std::vector<float> active_weights;
+    for (int i : active)
+        deltas.push_back(delta_row(i));
+    for (size_t f = 0; f < keys.size(); f++)
+        for (int i : active)
+            active_weights.push_back(frame_params[f * params_n + i]);
+
+    std::list<CachedFrame> baked;
+    std::vector<float*> outs;
+    for (const Hash& key : keys)
+    {
+        baked.push_back(CachedFrame());
+        baked.back().key = key;
+        baked.back().points.resize(size);
+        outs.push_back(baked.back().points.data());
+    }
+    blend_batch(outs, mean_row(), deltas, active_weights, size);
+
+    // baked frames go in front, least recently used frames fall out
+    for (auto it = baked.begin(); it != baked.end(); ++it)
+        frame_index[it->key.value()] = it;
+    frame_cache.splice(frame_cache.begin(), baked);
+    while (frame_cache.size() * frame_bytes > cache_budget())
+    {
+        frame_index.erase(frame_cache.back().key.value());
+        frame_cache.pop_back();
+    }
+}
+
+void CombineMultPCA::clear_frame_cache()
+{
+    frame_index.clear();
+    frame_cache.clear();
+}
+
 void CombineMultPCA::knobs(Knob_Callback f)
 {
-    for (int i = 0; i < pca_N; i++)
+    File_knob(f, &model_file, "model file", "Model File");
+    Tooltip(f, "Binary PCA model to blend from instead of the input geometry");
+
+    for (int group = 0; group * component_group_size < pca_N; group++)
     {
-        Float_knob(f, &params[i], "combination param", "combination param");
-        SetRange(f, -5,5);
+        BeginClosedGroup(f, group_names[group].c_str());
+        const int end = std::min(pca_N, (group + 1) * component_group_size);
+        for (int i = group * component_group_size; i < end; i++)
+        {
+            Float_knob(f, &params[i], param_names[i].c_str(), param_labels[i].c_str());
+            SetRange(f, -5,5);
+        }
+        EndGroup(f);
     }
+
+    BeginClosedGroup(f, "Playback Cache");
+    Bool_knob(f, &cache_frames, "cache frames", "Cache Frames");
+    Tooltip(f, "Blend the whole frame range in one batch and keep the points for playback");
+    Int_knob(f, &cache_first_frame, "cache first frame", "First Frame");
+    Int_knob(f, &cache_last_frame, "cache last frame", "Last Frame");
+    Float_knob(f, &cache_memory, "cache memory", "Memory (MB)");
+    SetRange(f, 0, 8192);
+    EndGroup(f);
+}
+
+bool CombineMultPCA::updateUI(const OutputContext& context)
+{
+    int components_n;
+    {
+        Guard guard(basis_lock);
+        components_n = has_basis ? obj_n - 1 : component_group_size;
+    }
+    show_components(components_n);
+    return GeoOp::updateUI(context);
 }
 
-CombineMultPCA::~CombineMultPCA()
+void CombineMultPCA::show_components(int components_n)
 {
-    delete[] params;
+    if (components_n == shown_components)
+        return;
+    shown_components = components_n;
+
+    // every group is created, those past the components of the input are
+    // hidden; the first group stays for an input that has none yet
+    for (int group = 0; group * component_group_size < pca_N; group++)
+    {
+        const bool visible = group == 0 || group * component_group_size < components_n;
+        if (Knob* group_knob = knob(group_names[group].c_str()))
+            group_knob->visible(visible);
+        const int end = std::min(pca_N, (group + 1) * component_group_size);
+        for (int i = group * component_group_size; i < end; i++)
+        {
+            if (Knob* param_knob = knob(param_names[i].c_str()))
+                param_knob->visible(visible);
+        }
+    }
 }
 
 namespace {
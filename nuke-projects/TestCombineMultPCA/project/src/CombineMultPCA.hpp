@@ -4,7 +4,14 @@
 #include "DDImage/Scene.h"
 #include "DDImage/Knobs.h"
 #include "DDImage/ViewFrustum.h"
+#include "DDImage/Thread.h"
+#include "BlendKernel.hpp"
+#include "ModelFile.hpp"
 #include <cassert>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
 
 
 class CombineMultPCA : public DD::Image::GeoOp
@@ -28,16 +35,103 @@ public:
     
     void knobs(DD::Image::Knob_Callback f) override;
 
-    ~CombineMultPCA();
+    bool updateUI(const DD::Image::OutputContext& context) override;
 
 protected:
     void _validate(bool for_real) override;
 
 private:
+    // Weights for up to pca_N components; the input decides how many of
+    // them are used. Knobs come in closed groups of component_group_size.
     int pca_N;
     unsigned int points_n;
     int obj_n;
-    float* params;
+    AlignedFloats params;
+    std::vector<std::string> param_names;
+    std::vector<std::string> param_labels;
+    std::vector<std::string> group_names;
+    int shown_components;
 
-    void combine_pca(DD::Image::GeometryList& out, const DD::Image::GeometryList& in) const;
+    // Mean and (component - mean) rows of the last cooked input, so that a
+    // params-only change neither cooks the input nor subtracts again.
+    DD::Image::Lock basis_lock;
+    bool has_basis;
+    DD::Image::Hash basis_hash;
+    size_t basis_row_size;
+    AlignedFloats mean_points;
+    AlignedFloats basis;
+    std::vector<float> delta_extents;
+    float model_scale;
+
+    // Input hash, matrix and attributes the output object was last built
+    // from; the params-only path needs all of them unchanged.
+    bool has_object;
+    DD::Image::Hash object_key;
+
+    // Bounds of the mean and of every delta row, min xyz then max xyz, from
+    // which the output bbox is derived without scanning the points.
+    float mean_bounds[6];
+    std::vector<float> delta_bounds;
+
+    // Optional mapped model file; when set the blend reads mean and deltas
+    // straight from the mapping and the input is not cooked.
+    const char* model_file;
+    std::shared_ptr<const ModelFile> model;
+
+    // Last blended points and the params they were made with; dragging a
+    // single param then only adds (w_new - w_old) * delta to them.
+    bool has_blend;
+    AlignedFloats blend_points;
+    std::vector<float> blend_params;
+    int incremental_updates;
+    float blend_error;
+
+    // Playback cache: points of whole frame ranges blended in one batch,
+    // kept in LRU order and keyed by basis hash and params.
+    struct CachedFrame {
+        DD::Image::Hash key;
+        AlignedFloats points;
+    };
+    bool cache_frames;
+    int cache_first_frame;
+    int cache_last_frame;
+    float cache_memory;
+    std::list<CachedFrame> frame_cache;
+    std::map<unsigned long long, std::list<CachedFrame>::iterator> frame_index;
+
+    DD::Image::Hash input_hash() const;
+
+    DD::Image::Hash object_hash() const;
+
+    void update_basis(const DD::Image::GeometryList& in);
+
+    void update_model_basis();
+
+    void build_model_object(DD::Image::GeometryList& out) const;
+
+    void reset_blend_state();
+
+    void update_extents();
+
+    void set_output_bbox(DD::Image::GeoInfo& info) const;
+
+    const float* mean_row() const;
+
+    const float* delta_row(int component) const;
+
+    bool update_blend_incrementally();
+
+    void combine_pca(DD::Image::PointList& out_points);
+
+    DD::Image::Hash frame_key(const float* weights) const;
+
+    size_t cache_budget() const;
+
+    bool load_cached_frame(DD::Image::PointList& out_points);
+
+    void bake_frames(int first_frame);
+
+    void clear_frame_cache();
+
+    void show_components(int components_n);
 };
\ No newline at end of file
@@ -0,0 +1,223 @@
+#include "ModelFile.hpp"
+
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    std::mutex registry_mutex;
+    std::map<std::string, std::weak_ptr<const ModelFile>> registry;
+
+    bool aligned(uint64_t offset)
+    {
+        return offset % 64 == 0;
+    }
+
+    bool inside(uint64_t offset, uint64_t bytes, size_t size)
+    {
+        return offset <= size && bytes <= size - offset;
+    }
+
+    // Write time and size folded into one value, so a file rewritten in
+    // place within the same timestamp tick still gets a new stamp.
+    uint64_t make_stamp(uint64_t write_time, uint64_t size)
+    {
+        return write_time ^ (size * 0x9e3779b97f4a7c15ull);
+    }
+}
+
+ModelFile::ModelFile():
+    data(nullptr),
+    size(0),
+    file_stamp(0)
+#ifdef _WIN32
+    , file(INVALID_HANDLE_VALUE),
+    mapping(nullptr)
+#endif
+{
+}
+
+ModelFile::~ModelFile()
+{
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+#else
+    if (data)
+        munmap(data, size);
+#endif
+}
+
+const float* ModelFile::mean() const
+{
+    return reinterpret_cast<const float*>(bytes() + header().mean_offset);
+}
+
+const float* ModelFile::delta(unsigned int component) const
+{
+    return reinterpret_cast<const float*>(bytes() + header().deltas_offset) + header().row_size * component;
+}
+
+const uint32_t* ModelFile::face_sizes() const
+{
+    return reinterpret_cast<const uint32_t*>(bytes() + header().face_sizes_offset);
+}
+
+const uint32_t* ModelFile::face_points() const
+{
+    return reinterpret_cast<const uint32_t*>(bytes() + header().face_points_offset);
+}
+
+bool ModelFile::valid(std::string& error) const
+{
+    if (size < sizeof(ModelFileHeader) || std::memcmp(header().magic, model_file_magic, sizeof(model_file_magic)) != 0)
+    {
+        error = "not a PCA model file";
+        return false;
+    }
+    const ModelFileHeader& h = header();
+    if (h.version != model_file_version)
+    {
+        error = "unsupported PCA model file version";
+        return false;
+    }
+
+    const uint64_t row_bytes = h.row_size * sizeof(float);
+    if (h.points_n == 0 || h.row_size < 3 * static_cast<uint64_t>(h.points_n) || row_bytes % 64 != 0 ||
+        !aligned(h.mean_offset) || !aligned(h.deltas_offset) ||
+        !inside(h.mean_offset, row_bytes, size) ||
+        !inside(h.deltas_offset, row_bytes * h.components_n, size) ||
+        !inside(h.face_sizes_offset, sizeof(uint32_t) * static_cast<uint64_t>(h.faces_n), size) ||
+        !inside(h.face_points_offset, sizeof(uint32_t) * h.face_vertices_n, size) ||
+        h.face_sizes_offset % sizeof(uint32_t) != 0 || h.face_points_offset % sizeof(uint32_t) != 0)
+    {
+        error = "PCA model file is truncated or corrupt";
+        return false;
+    }
+
+    uint64_t face_vertices_n = 0;
+    for (uint32_t face = 0; face < h.faces_n; face++)
+        face_vertices_n += face_sizes()[face];
+    if (face_vertices_n != h.face_vertices_n)
+    {
+        error = "PCA model file faces do not match their vertices";
+        return false;
+    }
+    for (uint64_t vertex = 0; vertex < h.face_vertices_n; vertex++)
+    {
+        if (face_points()[vertex] >= h.points_n)
+        {
+            error = "PCA model file faces use points out of range";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<const ModelFile> open_model_file(const std::string& path, std::string& error)
+{
+    std::lock_guard<std::mutex> guard(registry_mutex);
+
+    std::shared_ptr<ModelFile> model(new ModelFile());
+#ifdef _WIN32
+    model->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (model->file == INVALID_HANDLE_VALUE)
+    {
+        error = "can not open " + path;
+        return nullptr;
+    }
+    LARGE_INTEGER file_size;
+    FILETIME write_time;
+    if (!GetFileSizeEx(model->file, &file_size) || !GetFileTime(model->file, nullptr, nullptr, &write_time))
+    {
+        error = "can not read " + path;
+        return nullptr;
+    }
+    model->size = static_cast<size_t>(file_size.QuadPart);
+    model->file_stamp = make_stamp((static_cast<uint64_t>(write_time.dwHighDateTime) << 32) | write_time.dwLowDateTime,
+        model->size);
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = "can not open " + path;
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        error = "can not read " + path;
+        return nullptr;
+    }
+    model->size = static_cast<size_t>(info.st_size);
+#ifdef __APPLE__
+    const struct timespec& write_time = info.st_mtimespec;
+#else
+    const struct timespec& write_time = info.st_mtim;
+#endif
+    model->file_stamp = make_stamp(static_cast<uint64_t>(write_time.tv_sec) * 1000000000ull + static_cast<uint64_t>(write_time.tv_nsec),
+        model->size);
+#endif
+
+    const auto known = registry.find(path);
+    if (known != registry.end())
+    {
+        std::shared_ptr<const ModelFile> shared = known->second.lock();
+        if (shared && shared->size == model->size && shared->file_stamp == model->file_stamp)
+        {
+#ifndef _WIN32
+            close(fd);
+#endif
+            return shared;
+        }
+    }
+
+    if (model->size < sizeof(ModelFileHeader))
+    {
+#ifndef _WIN32
+        close(fd);
+#endif
+        error = "not a PCA model file";
+        return nullptr;
+    }
+
+#ifdef _WIN32
+    model->mapping = CreateFileMappingA(model->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (model->mapping)
+        model->data = MapViewOfFile(model->mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    // Pages of the mapping that were never written show later writes to
+    // the file, so a model rewritten in place is read torn. Writers must
+    // write a new file and rename it over the old one; the mapping then
+    // keeps the old file until it is opened again.
+    void* data = mmap(nullptr, model->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data != MAP_FAILED)
+        model->data = data;
+#endif
+    if (!model->data)
+    {
+        error = "can not map " + path;
+        return nullptr;
+    }
+    if (!model->valid(error))
+        return nullptr;
+
+    registry[path] = model;
+    return model;
+}
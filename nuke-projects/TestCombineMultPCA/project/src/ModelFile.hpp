@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Binary PCA model, little endian:
+//
+//   ModelFileHeader
+//   mean        row_size floats, the first 3 * points_n are xyz of the points
+//   deltas      components_n rows of row_size floats, component - mean
+//   face sizes  faces_n uint32, vertex count of every polygon
+//   face points face_vertices_n uint32, point index of every polygon vertex
+//
+// mean and every delta row start on a 64 byte boundary of the file, so the
+// blend reads them from the mapping as it would from AlignedFloats.
+struct ModelFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t points_n;
+    uint32_t components_n;
+    uint32_t faces_n;
+    uint64_t face_vertices_n;
+    uint64_t row_size;
+    uint64_t mean_offset;
+    uint64_t deltas_offset;
+    uint64_t face_sizes_offset;
+    uint64_t face_points_offset;
+};
+
+const char model_file_magic[8] = { 'P', 'C', 'A', 'M', 'O', 'D', 'E', 'L' };
+const uint32_t model_file_version = 1;
+
+// Read only mapping of a model file. Nodes using the same path share one
+// mapping, it is unmapped when the last of them lets go. A file changed in
+// place while mapped is read half old, half new: writers must write a new
+// file and rename it over the old one.
+class ModelFile
+{
+public:
+    ~ModelFile();
+
+    const ModelFileHeader& header() const { return *static_cast<const ModelFileHeader*>(data); }
+
+    const float* mean() const;
+
+    const float* delta(unsigned int component) const;
+
+    const uint32_t* face_sizes() const;
+
+    const uint32_t* face_points() const;
+
+    // changes whenever the file on disk is replaced or rewritten
+    uint64_t stamp() const { return file_stamp; }
+
+private:
+    friend std::shared_ptr<const ModelFile> open_model_file(const std::string& path, std::string& error);
+
+    ModelFile();
+
+    const char* bytes() const { return static_cast<const char*>(data); }
+
+    bool valid(std::string& error) const;
+
+    void* data;
+    size_t size;
+    uint64_t file_stamp;
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#endif
+};
+
+// Maps path, or returns the mapping another node already holds for it.
+// Returns null and describes the problem in error if the file can not be
+// mapped or is not a valid model.
+std::shared_ptr<const ModelFile> open_model_file(const std::string& path, std::string& error);
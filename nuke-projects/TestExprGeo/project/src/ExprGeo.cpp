@@ -0,0 +1,222 @@
+// ExprGeo.cpp
+
+static const char* const CLASS = "ExprGeo";
+static const char* const HELP =
+  "Move the XYZ of the points by expressions of x, y, z, the point index i "
+  "and the knobs a, b, c, d, e.g. pow(x, a) or x + b * sin(y * c).";
+
+#include "DDImage/ModifyGeo.h"
+#include "DDImage/Scene.h"
+#include "DDImage/Knob.h"
+#include "DDImage/Knobs.h"
+#include "DDImage/Thread.h"
+#include "ExprProgram.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+using namespace DD::Image;
+
+namespace {
+  // Points of all objects laid end to end and cut in chunks of whole
+  // batches, so one large object is split and many small ones batched
+  const size_t chunk_points = 64 * expr_batch_size;
+
+  struct ExprJob {
+    const Op* op;
+    const ExprProgram* programs[3];
+    float params[Expr_Params];
+    std::vector<float*> points;
+    std::vector<size_t> sizes;
+    std::vector<size_t> offsets;
+    std::atomic<size_t> next;
+  };
+
+  // Evaluates the points [begin, end) of one object batch by batch, the
+  // xyz of each batch is split into x, y and z arrays for the programs
+  void transform_points(const ExprJob& job, float* xyz, size_t begin, size_t end, std::vector<float>& scratch)
+  {
+    const size_t B = expr_batch_size;
+    float* inputs[Expr_Inputs];
+    for (int v = 0; v < Expr_Inputs; v++)
+      inputs[v] = scratch.data() + v * B;
+    float* results = scratch.data() + Expr_Inputs * B;
+    float* stack = results + 3 * B;
+
+    for (size_t first = begin; first < end; first += B) {
+      const size_t n = std::min(B, end - first);
+      const float* p = xyz + 3 * first;
+      for (size_t k = 0; k < n; k++) {
+        inputs[Expr_X][k] = p[3 * k];
+        inputs[Expr_Y][k] = p[3 * k + 1];
+        inputs[Expr_Z][k] = p[3 * k + 2];
+        inputs[Expr_Index][k] = float(first + k);
+      }
+      for (int axis = 0; axis < 3; axis++)
+        job.programs[axis]->evaluate(inputs, job.params, n, stack, results + axis * B);
+      float* q = xyz + 3 * first;
+      for (size_t k = 0; k < n; k++) {
+        q[3 * k] = results[k];
+        q[3 * k + 1] = results[B + k];
+        q[3 * k + 2] = results[2 * B + k];
+      }
+    }
+  }
+
+  void expr_chunks(unsigned, unsigned, void* data)
+  {
+    ExprJob* job = static_cast<ExprJob*>(data);
+    size_t stack_size = 0;
+    for (const ExprProgram* program : job->programs)
+      stack_size = std::max(stack_size, program->stack_size());
+    std::vector<float> scratch((Expr_Inputs + 3) * expr_batch_size + stack_size);
+
+    const size_t total = job->offsets.back();
+    for (size_t c = job->next++;; c = job->next++) {
+      const size_t begin = c * chunk_points;
+      if (begin >= total || job->op->aborted())
+        return;
+      const size_t end = std::min(begin + chunk_points, total);
+      size_t obj = std::upper_bound(job->offsets.begin(), job->offsets.end(), begin) - job->offsets.begin() - 1;
+      for (; obj < job->points.size() && job->offsets[obj] < end; obj++) {
+        const size_t first = std::max(begin, job->offsets[obj]) - job->offsets[obj];
+        const size_t last = std::min(end - job->offsets[obj], job->sizes[obj]);
+        if (first < last)
+          transform_points(*job, job->points[obj], first, last, scratch);
+      }
+    }
+  }
+}
+
+class ExprGeo : public ModifyGeo
+{
+private:
+  std::string expression[3];
+  float params[Expr_Params];
+
+  // The programs and the texts they were compiled from; a text is parsed
+  // again only when it changes, knob values are read when evaluating
+  std::string compiled[3];
+  ExprProgram programs[3];
+  std::string compile_error;
+
+  bool compile()
+  {
+    static const char* const names[3] = {"x", "y", "z"};
+    compile_error.clear();
+    for (int axis = 0; axis < 3; axis++) {
+      if (expression[axis] == compiled[axis] && !programs[axis].empty())
+        continue;
+      std::string message;
+      compiled[axis] = expression[axis];
+      if (!programs[axis].compile(expression[axis], message) && compile_error.empty())
+        compile_error = std::string(names[axis]) + " expression: " + message;
+    }
+    return compile_error.empty();
+  }
+
+public:
+  static const Description description;
+  const char* Class() const override
+  {
+    return CLASS;
+  }
+  const char* node_help() const override
+  {
+    return HELP;
+  }
+
+  ExprGeo(Node* node) : ModifyGeo(node)
+  {
+    expression[0] = "x";
+    expression[1] = "y";
+    expression[2] = "z";
+    std::fill(params, params + Expr_Params, 0.0f);
+  }
+
+  void knobs(Knob_Callback f) override
+  {
+    ModifyGeo::knobs(f);
+    String_knob(f, &expression[0], "x_expression", "x");
+    String_knob(f, &expression[1], "y_expression", "y");
+    String_knob(f, &expression[2], "z_expression", "z");
+    Float_knob(f, &params[Expr_A], "a");
+    Float_knob(f, &params[Expr_B], "b");
+    Float_knob(f, &params[Expr_C], "c");
+    Float_knob(f, &params[Expr_D], "d");
+  }
+
+  void _validate(bool for_real) override
+  {
+    if (!compile())
+      error("%s", compile_error.c_str());
+    ModifyGeo::_validate(for_real);
+  }
+
+  void get_geometry_hash() override
+  {
+    // Get all hashes up-to-date
+    ModifyGeo::get_geometry_hash();
+    // Knobs that change the point locations:
+    for (int axis = 0; axis < 3; axis++)
+      geo_hash[Group_Points].append(expression[axis]);
+    geo_hash[Group_Points].append(params, Expr_Params);
+  }
+
+  // Transform the points of objects [first, last), split over the threads
+  void transform(GeometryList& out, unsigned first, unsigned last)
+  {
+    if (!compile())
+      return;
+
+    ExprJob job;
+    job.op = this;
+    for (int axis = 0; axis < 3; axis++)
+      job.programs[axis] = &programs[axis];
+    std::copy(params, params + Expr_Params, job.params);
+    job.offsets.push_back(0);
+    for (unsigned obj = first; obj < last; obj++) {
+      PointList* points = out.writable_points(obj);
+      const size_t n = points->size();
+      if (n == 0)
+        continue;
+      // Vector3 is three packed floats
+      job.points.push_back(&(*points)[0].x);
+      job.sizes.push_back(n);
+      job.offsets.push_back(job.offsets.back() + n);
+    }
+    job.next = 0;
+
+    const size_t chunks = (job.offsets.back() + chunk_points - 1) / chunk_points;
+    const unsigned threads_n = static_cast<unsigned>(std::min<size_t>(Thread::numThreads, chunks));
+    if (threads_n < 2) {
+      expr_chunks(0, 1, &job);
+      return;
+    }
+    Thread::spawn(expr_chunks, threads_n, &job);
+    Thread::wait(&job);
+  }
+
+  // ModifyGeo calls modify_geometry object by object, the engine hands
+  // all objects to transform() at once instead
+  void geometry_engine(Scene& scene, GeometryList& out) override
+  {
+    input0()->get_geometry(scene, out);
+    transform(out, 0, out.objects());
+  }
+
+  void modify_geometry(int obj, Scene& scene, GeometryList& out) override
+  {
+    transform(out, obj, obj + 1);
+  }
+};
+
+static Op* build(Node* node)
+{
+  return new ExprGeo(node);
+}
+const Op::Description ExprGeo::description(CLASS, build);
+
+// end of ExprGeo.cpp
@@ -0,0 +1,451 @@
+#include "ExprProgram.hpp"
+#include "nuke-practice/LogKernel.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+  struct Name
+  {
+    const char* name;
+    int index;
+  };
+
+  const Name inputs[] = {{"x", Expr_X}, {"y", Expr_Y}, {"z", Expr_Z}, {"i", Expr_Index}};
+  const Name params[] = {{"a", Expr_A}, {"b", Expr_B}, {"c", Expr_C}, {"d", Expr_D}};
+
+  float clamp(float v, float lo, float hi)
+  {
+    return std::min(std::max(v, lo), hi);
+  }
+
+  // a[k] = f(a[k], b[k]), or f(a[k], s) without b
+  template <class F>
+  void combine(float* __restrict a, const float* __restrict b, float s, size_t n, F f)
+  {
+    if (b)
+      for (size_t k = 0; k < n; k++)
+        a[k] = f(a[k], b[k]);
+    else
+      for (size_t k = 0; k < n; k++)
+        a[k] = f(a[k], s);
+  }
+
+  template <class F>
+  void map(float* a, size_t n, F f)
+  {
+    for (size_t k = 0; k < n; k++)
+      a[k] = f(a[k]);
+  }
+}
+
+// Recursive descent over
+//   sum     = product (('+' | '-') product)*
+//   product = unary (('*' | '/') unary)*
+//   unary   = ('-' | '+') unary | power
+//   power   = primary ('^' unary)?
+//   primary = number | name | name '(' sum (',' sum)* ')' | '(' sum ')'
+// emitting postfix code as it goes.
+class ExprParser
+{
+  typedef ExprProgram::Code Code;
+  typedef ExprProgram::Instruction Instruction;
+
+  const char* text;
+  const char* at;
+  std::vector<Instruction>& code;
+  size_t depth;
+  size_t max_depth;
+  std::string error;
+
+  struct Function
+  {
+    const char* name;
+    Code code;
+    int arguments;
+  };
+
+  static const Function* find_function(const std::string& name)
+  {
+    static const Function functions[] = {
+      {"sin", ExprProgram::Sin, 1}, {"cos", ExprProgram::Cos, 1}, {"tan", ExprProgram::Tan, 1},
+      {"asin", ExprProgram::Asin, 1}, {"acos", ExprProgram::Acos, 1}, {"atan", ExprProgram::Atan, 1},
+      {"exp", ExprProgram::Exp, 1}, {"log", ExprProgram::Log, 1}, {"sqrt", ExprProgram::Sqrt, 1},
+      {"abs", ExprProgram::Abs, 1}, {"floor", ExprProgram::Floor, 1}, {"ceil", ExprProgram::Ceil, 1},
+      {"pow", ExprProgram::Power, 2}, {"atan2", ExprProgram::Atan2, 2},
+      {"min", ExprProgram::Min, 2}, {"max", ExprProgram::Max, 2},
+      {"clamp", ExprProgram::Clamp, 3}};
+    for (const Function& function : functions)
+      if (name == function.name)
+        return &function;
+    return nullptr;
+  }
+
+  static int operands(Code code)
+  {
+    switch (code) {
+      case ExprProgram::Push_Constant:
+      case ExprProgram::Push_Input:
+      case ExprProgram::Push_Param:
+        return 0;
+      case ExprProgram::Add:
+      case ExprProgram::Subtract:
+      case ExprProgram::Multiply:
+      case ExprProgram::Divide:
+      case ExprProgram::Power:
+      case ExprProgram::Atan2:
+      case ExprProgram::Min:
+      case ExprProgram::Max:
+        return 2;
+      case ExprProgram::Clamp:
+        return 3;
+      default:
+        return 1;
+    }
+  }
+
+  // The value of an operation on constants, the same as evaluate gives
+  static float fold(Code code, const float* v)
+  {
+    switch (code) {
+      case ExprProgram::Negate: return -v[0];
+      case ExprProgram::Add: return v[0] + v[1];
+      case ExprProgram::Subtract: return v[0] - v[1];
+      case ExprProgram::Multiply: return v[0] * v[1];
+      case ExprProgram::Divide: return v[0] / v[1];
+      case ExprProgram::Power: return std::pow(v[0], v[1]);
+      case ExprProgram::Sin: return std::sin(v[0]);
+      case ExprProgram::Cos: return std::cos(v[0]);
+      case ExprProgram::Tan: return std::tan(v[0]);
+      case ExprProgram::Asin: return std::asin(v[0]);
+      case ExprProgram::Acos: return std::acos(v[0]);
+      case ExprProgram::Atan: return std::atan(v[0]);
+      case ExprProgram::Exp: return std::exp(v[0]);
+      case ExprProgram::Log: return std::log(v[0]);
+      case ExprProgram::Sqrt: return std::sqrt(v[0]);
+      case ExprProgram::Abs: return std::fabs(v[0]);
+      case ExprProgram::Floor: return std::floor(v[0]);
+      case ExprProgram::Ceil: return std::ceil(v[0]);
+      case ExprProgram::Atan2: return std::atan2(v[0], v[1]);
+      case ExprProgram::Min: return std::min(v[0], v[1]);
+      case ExprProgram::Max: return std::max(v[0], v[1]);
+      case ExprProgram::Clamp: return clamp(v[0], v[1], v[2]);
+      default: return 0;
+    }
+  }
+
+  void push(Code code_, int index, float value)
+  {
+    code.push_back(Instruction{code_, index, value, ExprProgram::Operand_Stack});
+    depth++;
+    max_depth = std::max(max_depth, depth);
+  }
+
+  // Emits an operation on the values on top of the stack, or the constant
+  // it gives when they are all constants
+  void apply(Code operation)
+  {
+    const int n = operands(operation);
+    bool constant = code.size() >= size_t(n);
+    for (int k = 0; constant && k < n; k++)
+      constant = code[code.size() - n + k].code == ExprProgram::Push_Constant;
+    if (constant) {
+      float v[3];
+      for (int k = 0; k < n; k++)
+        v[k] = code[code.size() - n + k].value;
+      code.resize(code.size() - n);
+      depth -= n;
+      push(ExprProgram::Push_Constant, 0, fold(operation, v));
+      return;
+    }
+    // a constant or knob on the right is read in place instead of being
+    // spread over a batch first
+    Instruction instruction{operation, 0, 0.0f, ExprProgram::Operand_Stack};
+    const Instruction& right = code.back();
+    if (n == 2 && right.code == ExprProgram::Push_Constant) {
+      instruction.operand = ExprProgram::Operand_Constant;
+      instruction.value = right.value;
+      code.pop_back();
+    }
+    else if (n == 2 && right.code == ExprProgram::Push_Param) {
+      instruction.operand = ExprProgram::Operand_Param;
+      instruction.index = right.index;
+      code.pop_back();
+    }
+    code.push_back(instruction);
+    depth -= n - 1;
+  }
+
+  void skip_space()
+  {
+    while (std::isspace(static_cast<unsigned char>(*at)))
+      at++;
+  }
+
+  bool accept(char c)
+  {
+    skip_space();
+    if (*at != c)
+      return false;
+    at++;
+    return true;
+  }
+
+  bool fail(const std::string& message)
+  {
+    if (error.empty())
+      error = message + " at column " + std::to_string(at - text + 1);
+    return false;
+  }
+
+  bool sum()
+  {
+    if (!product())
+      return false;
+    for (;;) {
+      if (accept('+')) {
+        if (!product())
+          return false;
+        apply(ExprProgram::Add);
+      }
+      else if (accept('-')) {
+        if (!product())
+          return false;
+        apply(ExprProgram::Subtract);
+      }
+      else
+        return true;
+    }
+  }
+
+  bool product()
+  {
+    if (!unary())
+      return false;
+    for (;;) {
+      if (accept('*')) {
+        if (!unary())
+          return false;
+        apply(ExprProgram::Multiply);
+      }
+      else if (accept('/')) {
+        if (!unary())
+          return false;
+        apply(ExprProgram::Divide);
+      }
+      else
+        return true;
+    }
+  }
+
+  bool unary()
+  {
+    if (accept('-')) {
+      if (!unary())
+        return false;
+      apply(ExprProgram::Negate);
+      return true;
+    }
+    if (accept('+'))
+      return unary();
+    return power();
+  }
+
+  // -x^2 is -(x^2) and x^y^z is x^(y^z)
+  bool power()
+  {
+    if (!primary())
+      return false;
+    if (accept('^')) {
+      if (!unary())
+        return false;
+      apply(ExprProgram::Power);
+    }
+    return true;
+  }
+
+  bool primary()
+  {
+    skip_space();
+    if (std::isdigit(static_cast<unsigned char>(*at)) || *at == '.') {
+      char* end = nullptr;
+      const float value = std::strtof(at, &end);
+      if (end == at)
+        return fail("bad number");
+      at = end;
+      push(ExprProgram::Push_Constant, 0, value);
+      return true;
+    }
+    if (std::isalpha(static_cast<unsigned char>(*at)) || *at == '_') {
+      const char* start = at;
+      while (std::isalnum(static_cast<unsigned char>(*at)) || *at == '_')
+        at++;
+      const std::string name(start, at);
+      if (accept('('))
+        return call(name, start);
+
+      for (const Name& input : inputs)
+        if (name == input.name) {
+          push(ExprProgram::Push_Input, input.index, 0.0f);
+          return true;
+        }
+      for (const Name& param : params)
+        if (name == param.name) {
+          push(ExprProgram::Push_Param, param.index, 0.0f);
+          return true;
+        }
+      if (name == "pi") {
+        push(ExprProgram::Push_Constant, 0, 3.14159265f);
+        return true;
+      }
+      at = start;
+      return fail("unknown name '" + name + "'");
+    }
+    if (accept('(')) {
+      if (!sum())
+        return false;
+      if (!accept(')'))
+        return fail("')' expected");
+      return true;
+    }
+    if (*at == 0)
+      return fail("unexpected end");
+    return fail(std::string("unexpected '") + *at + "'");
+  }
+
+  bool call(const std::string& name, const char* start)
+  {
+    const Function* function = find_function(name);
+    if (!function) {
+      at = start;
+      return fail("unknown function '" + name + "'");
+    }
+    for (int argument = 0; argument < function->arguments; argument++) {
+      if (argument > 0 && !accept(','))
+        return fail(name + " takes " + std::to_string(function->arguments) + " arguments");
+      if (!sum())
+        return false;
+    }
+    if (!accept(')'))
+      return fail(name + " takes " + std::to_string(function->arguments) + " arguments");
+    apply(function->code);
+    return true;
+  }
+
+public:
+  ExprParser(const std::string& text_, std::vector<Instruction>& code_)
+    : text(text_.c_str()), at(text), code(code_), depth(0), max_depth(0)
+  {
+  }
+
+  bool parse(size_t& stack_depth, std::string& message)
+  {
+    code.clear();
+    bool ok = sum();
+    skip_space();
+    if (ok && *at != 0)
+      ok = fail("operator expected");
+    if (!ok) {
+      code.clear();
+      message = error;
+      return false;
+    }
+    stack_depth = max_depth;
+    return true;
+  }
+};
+
+ExprProgram::ExprProgram() : depth(0)
+{
+}
+
+bool ExprProgram::compile(const std::string& text, std::string& error)
+{
+  depth = 0;
+  ExprParser parser(text, code);
+  return parser.parse(depth, error);
+}
+
+bool ExprProgram::empty() const
+{
+  return code.empty();
+}
+
+size_t ExprProgram::stack_size() const
+{
+  return depth * expr_batch_size;
+}
+
+void ExprProgram::evaluate(const float* const inputs_[Expr_Inputs],
+                           const float params_[Expr_Params],
+                           size_t n,
+                           float* stack,
+                           float* out) const
+{
+  // The stack holds one batch per value
+  size_t size = 0;
+  for (const Instruction& instruction : code) {
+    float* top = stack + (size > 0 ? size - 1 : 0) * expr_batch_size;
+
+    // Two operand instructions write to their left operand; that is the
+    // value below the top unless the right one is an immediate
+    const bool immediate = instruction.operand != Operand_Stack;
+    const float s = instruction.operand == Operand_Param ? params_[instruction.index] : instruction.value;
+    float* a = immediate ? top : top - expr_batch_size;
+    const float* b = immediate ? nullptr : top;
+
+    switch (instruction.code) {
+      case Push_Constant:
+        top = stack + size++ * expr_batch_size;
+        std::fill(top, top + n, instruction.value);
+        continue;
+      case Push_Input:
+        top = stack + size++ * expr_batch_size;
+        std::memcpy(top, inputs_[instruction.index], n * sizeof(float));
+        continue;
+      case Push_Param:
+        top = stack + size++ * expr_batch_size;
+        std::fill(top, top + n, params_[instruction.index]);
+        continue;
+
+      case Negate: map(top, n, [](float v) { return -v; }); continue;
+      case Sin: map(top, n, [](float v) { return std::sin(v); }); continue;
+      case Cos: map(top, n, [](float v) { return std::cos(v); }); continue;
+      case Tan: map(top, n, [](float v) { return std::tan(v); }); continue;
+      case Asin: map(top, n, [](float v) { return std::asin(v); }); continue;
+      case Acos: map(top, n, [](float v) { return std::acos(v); }); continue;
+      case Atan: map(top, n, [](float v) { return std::atan(v); }); continue;
+      case Exp: exp_values(top, n); continue;
+      case Log: log_values(top, n); continue;
+      case Sqrt: map(top, n, [](float v) { return std::sqrt(v); }); continue;
+      case Abs: map(top, n, [](float v) { return std::fabs(v); }); continue;
+      case Floor: map(top, n, [](float v) { return std::floor(v); }); continue;
+      case Ceil: map(top, n, [](float v) { return std::ceil(v); }); continue;
+
+      case Clamp: {
+        float* v = top - 2 * expr_batch_size;
+        const float* lo = top - expr_batch_size;
+        for (size_t k = 0; k < n; k++)
+          v[k] = clamp(v[k], lo[k], top[k]);
+        size -= 2;
+        continue;
+      }
+
+      case Add: combine(a, b, s, n, [](float u, float v) { return u + v; }); break;
+      case Subtract: combine(a, b, s, n, [](float u, float v) { return u - v; }); break;
+      case Multiply: combine(a, b, s, n, [](float u, float v) { return u * v; }); break;
+      case Divide: combine(a, b, s, n, [](float u, float v) { return u / v; }); break;
+      case Power: pow_values(a, b, s, n); break;
+      case Atan2: combine(a, b, s, n, [](float u, float v) { return std::atan2(u, v); }); break;
+      case Min: combine(a, b, s, n, [](float u, float v) { return std::min(u, v); }); break;
+      case Max: combine(a, b, s, n, [](float u, float v) { return std::max(u, v); }); break;
+    }
+    if (!immediate)
+      size--;
+  }
+  if (size > 0)
+    std::memcpy(out, stack + (size - 1) * expr_batch_size, n * sizeof(float));
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Per point inputs of an expression, each a float array of the batch
+enum ExprInput { Expr_X, Expr_Y, Expr_Z, Expr_Index, Expr_Inputs };
+
+// Knob values an expression can read, the same for every point
+enum ExprParam { Expr_A, Expr_B, Expr_C, Expr_D, Expr_Params };
+
+// Points evaluated at once. Arithmetic, sqrt, abs, floor, ceil, min, max
+// and clamp are plain loops over the batch which the compiler turns into
+// vector code; exp, log and ^ (pow) use the vector kernels of LogGeo. The
+// trigonometric functions call the C library for every point.
+const size_t expr_batch_size = 256;
+
+// An expression over x, y, z, the point index i and the knob values a, b,
+// c, d compiled to a stack bytecode. Numbers, + - * / ^, unary minus,
+// parentheses, pi and the functions sin cos tan asin acos atan exp log
+// sqrt abs floor ceil (one argument), pow atan2 min max (two) and clamp
+// (three) are understood. Constant parts are folded while compiling. Has
+// no DDImage dependency.
+class ExprProgram
+{
+public:
+  ExprProgram();
+
+  // Replaces the program by the compiled text. On a syntax error returns
+  // false with a message and leaves the program empty.
+  bool compile(const std::string& text, std::string& error);
+
+  bool empty() const;
+
+  // Floats of scratch memory evaluate needs
+  size_t stack_size() const;
+
+  // out[k] for k < n, n <= expr_batch_size, from the inputs of the batch.
+  // out may be one of the inputs.
+  void evaluate(const float* const inputs[Expr_Inputs],
+                const float params[Expr_Params],
+                size_t n,
+                float* stack,
+                float* out) const;
+
+private:
+  enum Code {
+    Push_Constant, Push_Input, Push_Param,
+    Negate, Add, Subtract, Multiply, Divide, Power,
+    Sin, Cos, Tan, Asin, Acos, Atan, Exp, Log, Sqrt, Abs, Floor, Ceil,
+    Atan2, Min, Max, Clamp
+  };
+
+  // Where the right operand of a two operand instruction comes from: the
+  // stack, or value or params[index] when it is a constant or a knob
+  enum Operand { Operand_Stack, Operand_Constant, Operand_Param };
+
+  struct Instruction
+  {
+    Code code;
+    int index;
+    float value;
+    Operand operand;
+  };
+
+  std::vector<Instruction> code;
+  size_t depth;
+
+  friend class ExprParser;
+};
@@ -1,4 +1,6 @@
 #include "PCAGeo.hpp"
+#include "nuke-practice/Morton.hpp"
+#include <algorithm>
 #include <vector>
 
 using namespace DD::Image;
@@ -6,21 +8,76 @@ using namespace DD::Image;
 namespace {
     const char* const CLASS = "PCAGeo";
     const char* const HELP = "Combine geometries of two objects";
+
+    enum PreviewMode { PREVIEW_OFF, PREVIEW_PROXY, PREVIEW_ON };
+    const char* const preview_modes[] = { "off", "in proxy mode", "on", nullptr };
+
+    // Picks about fraction of the points, spread evenly over space: points are
+    // ordered along a Morton curve over their bounding box and every n-th one
+    // is taken. Returns ascending point indices. The knob range is only a
+    // slider hint, so the fraction is clamped to [0.01, 1] here.
+    std::vector<unsigned int> sample_points(const PointList& points, unsigned int points_n, float fraction)
+    {
+        fraction = std::min(1.0f, std::max(0.01f, fraction));
+        const unsigned int step = static_cast<unsigned int>(1.0f / fraction + 0.5f);
+        if (step == 1 || points_n <= step)
+        {
+            std::vector<unsigned int> all(points_n);
+            for (unsigned int j = 0; j < points_n; j++)
+                all[j] = j;
+            return all;
+        }
+
+        Vector3 lo = points[0];
+        Vector3 hi = points[0];
+        for (unsigned int j = 1; j < points_n; j++)
+        {
+            const Vector3& v = points[j];
+            lo.x = std::min(lo.x, v.x); lo.y = std::min(lo.y, v.y); lo.z = std::min(lo.z, v.z);
+            hi.x = std::max(hi.x, v.x); hi.y = std::max(hi.y, v.y); hi.z = std::max(hi.z, v.z);
+        }
+        const float extent = std::max(std::max(hi.x - lo.x, hi.y - lo.y), std::max(hi.z - lo.z, 1e-20f));
+        const float scale = 1023.0f / extent;
+
+        std::vector<std::pair<unsigned int, unsigned int>> codes(points_n);
+        for (unsigned int j = 0; j < points_n; j++)
+        {
+            const Vector3& v = points[j];
+            const unsigned int code = spread_bits(static_cast<unsigned int>((v.x - lo.x) * scale))
+                | (spread_bits(static_cast<unsigned int>((v.y - lo.y) * scale)) << 1)
+                | (spread_bits(static_cast<unsigned int>((v.z - lo.z) * scale)) << 2);
+            codes[j] = std::make_pair(code, j);
+        }
+        std::sort(codes.begin(), codes.end());
+
+        std::vector<unsigned int> sample;
+        sample.reserve(points_n / step + 1);
+        for (unsigned int j = step / 2; j < points_n; j += step)
+            sample.push_back(codes[j].second);
+        std::sort(sample.begin(), sample.end());
+        return sample;
+    }
+
+    int solve_pca(Pca& pca, std::vector<float>& data, int rows,
+        const std::vector<unsigned int>& sample_cols, const PcaControl& control)
+    {
+        const unsigned int cols = static_cast<unsigned int>(data.size()) / rows;
+        if (sample_cols.empty())
+            return pca.Calculate(data, rows, cols, control);
+        return pca.CalculateSampled(data, rows, cols, sample_cols, control);
+    }
 }
 
 
 void PCAGeo::_validate(bool for_real)
 {
-    int current_inputs_n = 0;
     for (int i = 0; i < max_inputs_N; i++)
     {
         if (Op::input(i) != nullptr)
         {
             Op::input(i)->validate(for_real);
-            current_inputs_n++;
         }
     }
-    inputs_N = current_inputs_n;
     GeoOp::_validate(for_real);
 }
 
@@ -37,14 +94,15 @@ const char* PCAGeo::node_help() const
 PCAGeo::PCAGeo(Node* node):
     GeoOp(node),
     max_inputs_N(10),
-    inputs_N(0),
-    points_N(0),
-    objs_N(0),
-    mid_obj_id(0),
     min_pca_N(1),
     pretty_show(false),
+    per_object(false),
+    async_solve(false),
+    preview_mode(PREVIEW_OFF),
+    preview_fraction(0.05f),
     var_threshold(0.2),
-    d_x(2) {}
+    d_x(2),
+    model_generation(0) {}
 
 int PCAGeo::minimum_inputs() const
 {
@@ -61,47 +119,138 @@ void PCAGeo::get_geometry_hash()
     GeoOp::get_geometry_hash();
     geo_hash[Group_Points].append(min_pca_N);
     geo_hash[Group_Points].append(pretty_show);
+    geo_hash[Group_Points].append(per_object);
     geo_hash[Group_Points].append(var_threshold);
     geo_hash[Group_Points].append(d_x);
+    geo_hash[Group_Points].append(async_solve);
+    geo_hash[Group_Points].append(preview_active());
+    geo_hash[Group_Points].append(preview_fraction);
+    if (async_solve)
+    {
+        // a model landing from the background solve has to trigger a recook
+        Guard guard(model_lock);
+        geo_hash[Group_Points].append(model_generation);
+    }
 }
 
 void PCAGeo::geometry_engine(Scene& scene, GeometryList& out)
 {
-    GeometryList in;
+    CookContext ctx;
+    ctx.per_object = per_object;
+    ctx.preview = preview_active();
+    fetch_inputs(ctx);
+    if (aborted())
+        return;
+
+    const GeometryList& in = ctx.inputs[0];
+    ctx.objs_n = in.objects();
+    if (ctx.objs_n == 0)
     {
-        Scene in_scene;
-        input(0)->get_geometry(in_scene, in);
+        error("First input has no objects");
+        return;
+    }
+    ctx.points_n = in[0].points();
+    for (unsigned int obj_id = 0; obj_id < ctx.objs_n; obj_id++)
+    {
+        // an object without points has no components to show
+        if (in[obj_id].points() == 0)
+        {
+            error("Object %u of the first input has no points", obj_id);
+            return;
+        }
     }
-    objs_N = in.objects();
-    assert(objs_N > 0);
-    points_N = in[0].points();
 
-    auto result_vec = prepare_data();
+    if (async_solve)
+    {
+        geometry_engine_async(ctx, out);
+        return;
+    }
 
-    Pca pca;
-    const int init_result = pca.Calculate(result_vec, inputs_N, objs_N * points_N * 3);
-    assert(init_result == 0);
+    if (ctx.per_object)
+    {
+        geometry_engine_per_object(ctx, out);
+        return;
+    }
+
+    auto result_vec = prepare_data(ctx);
+
+    PcaControl control;
+    control.cancelled = [this]() { return aborted(); };
+    control.progress = [this](float fraction) { progressFraction(fraction); };
 
-    process_extreme_points(pca, out, &in[0]);
+    std::vector<Pca> pcas(1);
+    const int init_result = solve_pca(pcas[0], result_vec, ctx.inputs_n, sample_columns(ctx, -1), control);
+    if (init_result == -2)
+        return;
+    if (init_result != 0)
+    {
+        error("PCA solve failed");
+        return;
+    }
+
+    write_model(ctx, pcas, false, out);
 }
 
-std::vector<float> PCAGeo::prepare_data() const
+void PCAGeo::fetch_inputs(CookContext& ctx) const
 {
-    std::vector<float> result_vec;
-    for (int geo_id = 0; geo_id < inputs_N; geo_id++)
+    ctx.inputs_n = 0;
+    while (ctx.inputs_n < max_inputs_N && Op::input(ctx.inputs_n) != nullptr)
+    {
+        ctx.inputs_n++;
+    }
+
+    ctx.inputs.resize(ctx.inputs_n);
+    for (int geo_id = 0; geo_id < ctx.inputs_n; geo_id++)
     {
-        GeometryList in;
+        Scene in_scene;
+        input(geo_id)->get_geometry(in_scene, ctx.inputs[geo_id]);
+    }
+}
+
+bool PCAGeo::preview_active() const
+{
+    return preview_mode == PREVIEW_ON || (preview_mode == PREVIEW_PROXY && outputContext().proxy());
+}
+
+std::vector<unsigned int> PCAGeo::sample_columns(const CookContext& ctx, int obj_id) const
+{
+    std::vector<unsigned int> sample_cols;
+    if (!ctx.preview)
+        return sample_cols;
+
+    // columns of one object in the data rows, or of every object in turn
+    const unsigned int first_obj = obj_id < 0 ? 0 : obj_id;
+    const unsigned int last_obj = obj_id < 0 ? ctx.objs_n : obj_id + 1;
+    for (unsigned int cur_obj = first_obj; cur_obj < last_obj; cur_obj++)
+    {
+        const GeoInfo& info = ctx.inputs[0][cur_obj];
+        const unsigned int obj_points_n = obj_id < 0 ? ctx.points_n : info.points();
+        const unsigned int offset = obj_id < 0 ? cur_obj * ctx.points_n * 3 : 0;
+
+        for (unsigned int j : sample_points(*info.point_list(), obj_points_n, preview_fraction))
         {
-            Scene in_scene;
-            input(geo_id)->get_geometry(in_scene, in);
+            sample_cols.push_back(offset + 3 * j);
+            sample_cols.push_back(offset + 3 * j + 1);
+            sample_cols.push_back(offset + 3 * j + 2);
         }
+    }
+    return sample_cols;
+}
 
-        for (unsigned int obj_id = 0; obj_id < objs_N; obj_id++) {
+std::vector<float> PCAGeo::prepare_data(const CookContext& ctx) const
+{
+    std::vector<float> result_vec;
+    result_vec.reserve(ctx.inputs_n * ctx.objs_n * ctx.points_n * 3);
+    for (int geo_id = 0; geo_id < ctx.inputs_n; geo_id++)
+    {
+        const GeometryList& in = ctx.inputs[geo_id];
 
-            GeoInfo& info = in[obj_id];
+        for (unsigned int obj_id = 0; obj_id < ctx.objs_n; obj_id++) {
+
+            const GeoInfo& info = in[obj_id];
             const PointList* points = info.point_list();
 
-            for (unsigned int j = 0; j < points_N; j++) {
+            for (unsigned int j = 0; j < ctx.points_n; j++) {
                 const Vector3& v = (*points)[j];
                 result_vec.push_back(v.x);
                 result_vec.push_back(v.y);
@@ -109,11 +258,310 @@ std::vector<float> PCAGeo::prepare_data() const
             }
         }
     }
-    assert(result_vec.size() == inputs_N * objs_N * points_N * 3);
+    assert(result_vec.size() == ctx.inputs_n * ctx.objs_n * ctx.points_n * 3);
     return result_vec;
 }
 
-void PCAGeo::process_extreme_points(Pca& pca, GeometryList& out, GeoInfo*  info_to_copy)
+std::vector<float> PCAGeo::prepare_object_data(const CookContext& ctx, unsigned int obj_id) const
+{
+    const unsigned int obj_points_n = ctx.inputs[0][obj_id].points();
+
+    std::vector<float> result_vec;
+    result_vec.reserve(ctx.inputs_n * obj_points_n * 3);
+    for (int geo_id = 0; geo_id < ctx.inputs_n; geo_id++)
+    {
+        const GeoInfo& info = ctx.inputs[geo_id][obj_id];
+        const PointList* points = info.point_list();
+        assert(points->size() == obj_points_n);
+
+        for (unsigned int j = 0; j < obj_points_n; j++) {
+            const Vector3& v = (*points)[j];
+            result_vec.push_back(v.x);
+            result_vec.push_back(v.y);
+            result_vec.push_back(v.z);
+        }
+    }
+    return result_vec;
+}
+
+// Work shared by the threads solving one PCA per object.
+struct PCAGeo::ObjectSolveJob {
+    PCAGeo* op;
+    const CookContext* ctx;
+    std::vector<Pca>* pcas;
+    std::vector<int>* results;
+    std::atomic<unsigned int> next_obj;
+    std::vector<std::atomic<float>>* progress;
+    Lock progress_lock;
+};
+
+void PCAGeo::solve_objects(unsigned index, unsigned threads_n, void* data)
+{
+    ObjectSolveJob* job = static_cast<ObjectSolveJob*>(data);
+    PCAGeo* op = job->op;
+    const CookContext& ctx = *job->ctx;
+
+    // objects differ a lot in size (head vs. eyes), so hand them out one by one
+    for (unsigned int obj_id = job->next_obj++; obj_id < ctx.objs_n; obj_id = job->next_obj++)
+    {
+        PcaControl control;
+        control.cancelled = [op]() { return op->aborted(); };
+        control.progress = [job, op, obj_id, &ctx](float fraction) {
+            (*job->progress)[obj_id] = fraction;
+            float total = 0;
+            for (auto& obj_fraction : *job->progress)
+                total += obj_fraction;
+            Guard guard(job->progress_lock);
+            op->progressFraction(total / ctx.objs_n);
+        };
+
+        auto obj_vec = op->prepare_object_data(ctx, obj_id);
+        (*job->results)[obj_id] = solve_pca((*job->pcas)[obj_id], obj_vec, ctx.inputs_n,
+            op->sample_columns(ctx, obj_id), control);
+    }
+}
+
+void PCAGeo::geometry_engine_per_object(const CookContext& ctx, GeometryList& out)
+{
+    for (int geo_id = 1; geo_id < ctx.inputs_n; geo_id++)
+    {
+        assert(ctx.inputs[geo_id].objects() == ctx.objs_n);
+    }
+
+    std::vector<Pca> pcas(ctx.objs_n);
+    std::vector<int> results(ctx.objs_n, -1);
+    std::vector<std::atomic<float>> progress(ctx.objs_n);
+    for (auto& obj_fraction : progress)
+        obj_fraction = 0;
+
+    ObjectSolveJob job;
+    job.op = this;
+    job.ctx = &ctx;
+    job.pcas = &pcas;
+    job.results = &results;
+    job.next_obj = 0;
+    job.progress = &progress;
+
+    const unsigned int threads_n = std::max(1u, std::min(ctx.objs_n, Thread::numThreads));
+    Thread::spawn(solve_objects, threads_n, &job);
+    Thread::wait(&job);
+    if (aborted())
+        return;
+
+    for (unsigned int obj_id = 0; obj_id < ctx.objs_n; obj_id++)
+    {
+        if (results[obj_id] != 0)
+        {
+            error("PCA solve failed for object %u", obj_id);
+            return;
+        }
+    }
+    write_model(ctx, pcas, true, out);
+}
+
+// A finished decomposition and the inputs hash it was solved for.
+struct PCAGeo::PcaModel {
+    Hash key;
+    bool per_object;
+    std::vector<Pca> pcas;
+};
+
+// Data handed over to the background solve.
+struct PCAGeo::SolveJob {
+    PCAGeo* op;
+    Hash key;
+    bool per_object;
+    int rows;
+    std::vector<std::vector<float>> data;
+    std::vector<std::vector<unsigned int>> samples;
+    std::atomic<bool> cancelled;
+    // set when the solve returned an error rather than a model
+    std::atomic<bool> failed;
+};
+
+Hash PCAGeo::inputs_hash(const CookContext& ctx) const
+{
+    Hash key;
+    for (int geo_id = 0; geo_id < ctx.inputs_n; geo_id++)
+    {
+        key.append(input(geo_id)->hash(Group_Points));
+        key.append(input(geo_id)->hash(Group_Primitives));
+    }
+    key.append(ctx.per_object);
+    key.append(ctx.preview);
+    if (ctx.preview)
+        key.append(preview_fraction);
+    return key;
+}
+
+void PCAGeo::geometry_engine_async(const CookContext& ctx, GeometryList& out)
+{
+    const Hash key = inputs_hash(ctx);
+
+    if (take_failed_solve(key))
+    {
+        error("PCA solve failed");
+        return;
+    }
+
+    std::shared_ptr<PcaModel> solved;
+    {
+        Guard guard(model_lock);
+        solved = model;
+    }
+
+    if (!solved || solved->key != key)
+    {
+        start_solve(key, ctx);
+    }
+
+    const GeometryList& in = ctx.inputs[0];
+    if (!solved || !model_fits(ctx, *solved))
+    {
+        // nothing to show yet, pass the first input through
+        out.delete_objects();
+        for (unsigned int obj_id = 0; obj_id < ctx.objs_n; obj_id++)
+        {
+            out.add_object(obj_id);
+            out[obj_id].copy(&in[obj_id]);
+        }
+        warning("PCA is being solved in background");
+        return;
+    }
+
+    write_model(ctx, solved->pcas, solved->per_object, out);
+    if (solved->key != key)
+    {
+        warning("PCA model is out of date, solving in background");
+    }
+}
+
+void PCAGeo::start_solve(const Hash& key, const CookContext& ctx)
+{
+    Guard guard(solve_lock);
+    if (solve_job)
+    {
+        if (solve_job->key == key && !solve_job->failed)
+            return;
+        // the running solve is for inputs nobody looks at anymore
+        solve_job->cancelled = true;
+        Thread::wait(solve_job.get());
+    }
+
+    std::unique_ptr<SolveJob> job(new SolveJob);
+    job->op = this;
+    job->key = key;
+    job->per_object = ctx.per_object;
+    job->rows = ctx.inputs_n;
+    job->cancelled = false;
+    job->failed = false;
+    if (ctx.per_object)
+    {
+        for (unsigned int obj_id = 0; obj_id < ctx.objs_n; obj_id++)
+        {
+            job->data.push_back(prepare_object_data(ctx, obj_id));
+            job->samples.push_back(sample_columns(ctx, obj_id));
+        }
+    }
+    else
+    {
+        job->data.push_back(prepare_data(ctx));
+        job->samples.push_back(sample_columns(ctx, -1));
+    }
+
+    solve_job = std::move(job);
+    Thread::spawn(run_solve, 1, solve_job.get());
+}
+
+void PCAGeo::run_solve(unsigned index, unsigned threads_n, void* data)
+{
+    SolveJob* job = static_cast<SolveJob*>(data);
+
+    std::shared_ptr<PcaModel> solved = std::make_shared<PcaModel>();
+    solved->key = job->key;
+    solved->per_object = job->per_object;
+    solved->pcas.resize(job->data.size());
+
+    PcaControl control;
+    control.cancelled = [job]() { return job->cancelled.load(); };
+
+    for (size_t i = 0; i < job->data.size(); i++)
+    {
+        std::vector<float>& solve_data = job->data[i];
+        const int result = solve_pca(solved->pcas[i], solve_data, job->rows, job->samples[i], control);
+        if (result == -2)
+            return;
+        if (result != 0)
+        {
+            // recook so the engine reports the error instead of waiting
+            job->failed = true;
+            {
+                Guard guard(job->op->model_lock);
+                job->op->model_generation++;
+            }
+            job->op->asapUpdate();
+            return;
+        }
+        std::vector<float>().swap(solve_data);
+    }
+
+    {
+        Guard guard(job->op->model_lock);
+        job->op->model = solved;
+        job->op->model_generation++;
+    }
+    job->op->asapUpdate();
+}
+
+bool PCAGeo::take_failed_solve(const Hash& key)
+{
+    Guard guard(solve_lock);
+    if (!solve_job || solve_job->key != key || !solve_job->failed)
+        return false;
+    // drop the job so that the next cook of the same inputs solves again
+    // rather than waiting on it forever
+    Thread::wait(solve_job.get());
+    solve_job.reset();
+    return true;
+}
+
+bool PCAGeo::model_fits(const CookContext& ctx, PcaModel& solved) const
+{
+    if (!solved.per_object)
+    {
+        return solved.pcas.size() == 1 && solved.pcas[0].pca_size().second == ctx.objs_n * ctx.points_n * 3;
+    }
+
+    if (solved.pcas.size() != ctx.objs_n)
+        return false;
+    for (unsigned int obj_id = 0; obj_id < ctx.objs_n; obj_id++)
+    {
+        if (solved.pcas[obj_id].pca_size().second != ctx.inputs[0][obj_id].points() * 3)
+            return false;
+    }
+    return true;
+}
+
+void PCAGeo::write_model(const CookContext& ctx, std::vector<Pca>& pcas, bool model_per_object, GeometryList& out) const
+{
+    const GeometryList& in = ctx.inputs[0];
+    out.delete_objects();
+    if (!model_per_object)
+    {
+        process_extreme_points(pcas[0], out, &in[0], ctx.points_n, 0);
+        return;
+    }
+
+    int out_id = 0;
+    for (unsigned int obj_id = 0; obj_id < ctx.objs_n; obj_id++)
+    {
+        const GeoInfo& info = in[obj_id];
+        out_id += process_extreme_points(pcas[obj_id], out, &info, info.points(), out_id);
+    }
+}
+
+int PCAGeo::process_extreme_points(Pca& pca, GeometryList& out, const GeoInfo* info_to_copy,
+    unsigned int obj_points_n, int first_out_id) const
 {
     int pca_n = pca.pca_size().first;
     int thresh_i = min_pca_N >= 0 ? min(min_pca_N, pca_n) : 0;
@@ -127,23 +575,25 @@ void PCAGeo::process_extreme_points(Pca& pca, GeometryList& out, GeoInfo*  info_
         }
     }
     pca_n = thresh_i;
-    mid_obj_id = pca_n / 2;
+    const int mid_obj_id = pca_n / 2;
 
-    out.delete_objects();
     std::vector<float> mean = pca.mean();
-    write_neutral_model(mean, out, info_to_copy);
+    write_neutral_model(mean, out, info_to_copy, obj_points_n, first_out_id, mid_obj_id);
 
     auto extreme_points = pca.calculate_extreme_points(pca_n);
-    write_pca_models(extreme_points, pca_n, out, info_to_copy);
+    write_pca_models(extreme_points, pca_n, out, info_to_copy, obj_points_n, first_out_id + 1, mid_obj_id);
+
+    return pca_n + 1;
 }
 
-void PCAGeo::write_neutral_model(std::vector<float>& mean, GeometryList& out, GeoInfo*  info) const
+void PCAGeo::write_neutral_model(std::vector<float>& mean, GeometryList& out, const GeoInfo* info,
+    unsigned int obj_points_n, int out_id, int mid_obj_id) const
 {
-    out.add_object(0);
-    out[0].copy(info);
-    PointList* points = out.writable_points(0);
+    out.add_object(out_id);
+    out[out_id].copy(info);
+    PointList* points = out.writable_points(out_id);
 
-    for (unsigned int j = 0; j < points_N; j++)
+    for (unsigned int j = 0; j < obj_points_n; j++)
     {
         Vector3& v = (*points)[j];
         v.x = mean[3 * j];
@@ -152,7 +602,7 @@ void PCAGeo::write_neutral_model(std::vector<float>& mean, GeometryList& out, Ge
     }
 
     if (pretty_show) {
-        out[0].matrix.translate(mid_obj_id*d_x, 0, 0);
+        out[out_id].matrix.translate(mid_obj_id*d_x, 0, 0);
     }
 }
 
@@ -160,16 +610,20 @@ void PCAGeo::write_pca_models(
     std::vector<std::vector<float>>& pca_points, 
     int pca_n, 
     GeometryList& out, 
-    GeoInfo* info) const
+    const GeoInfo* info,
+    unsigned int obj_points_n,
+    int first_out_id,
+    int mid_obj_id) const
 {
     for (int pca_id = 1; pca_id < pca_n+1; pca_id++)
     {
-        out.add_object(pca_id);
-        out[pca_id].copy(info);
-        PointList* points = out.writable_points(pca_id);
-        std::vector<float> current_obj = pca_points[pca_id-1];
+        const int out_id = first_out_id + pca_id - 1;
+        out.add_object(out_id);
+        out[out_id].copy(info);
+        PointList* points = out.writable_points(out_id);
+        const std::vector<float>& current_obj = pca_points[pca_id-1];
 
-        for (unsigned int j = 0; j < points_N; j++)
+        for (unsigned int j = 0; j < obj_points_n; j++)
         {
             Vector3& v = (*points)[j];
             v.x = current_obj[3 * j];
@@ -178,7 +632,7 @@ void PCAGeo::write_pca_models(
         }
 
         if (pretty_show) {
-            out[pca_id].matrix.translate((mid_obj_id - pca_id)*d_x, 0, 0);
+            out[out_id].matrix.translate((mid_obj_id - pca_id)*d_x, 0, 0);
         }
     }
 }
@@ -192,6 +646,21 @@ void PCAGeo::knobs(Knob_Callback f)
     SetRange(f, 0, max_inputs_N);
     Float_knob(f, &var_threshold, "variance threshold", "Variance Threshold");
     SetRange(f, 0, 1);
+    Bool_knob(f, &per_object, "independent PCA for every object", "Per Object");
+    Bool_knob(f, &async_solve, "solve PCA in background", "Async");
+    Enumeration_knob(f, &preview_mode, preview_modes, "solve PCA on a subsample of points", "Preview");
+    Float_knob(f, &preview_fraction, "fraction of points used in preview", "Preview Fraction");
+    SetRange(f, 0.01, 1);
+}
+
+PCAGeo::~PCAGeo()
+{
+    Guard guard(solve_lock);
+    if (solve_job)
+    {
+        solve_job->cancelled = true;
+        Thread::wait(solve_job.get());
+    }
 }
 
 namespace { 
@@ -4,8 +4,11 @@
 #include "DDImage/Scene.h"
 #include "DDImage/Knobs.h"
 #include "DDImage/ViewFrustum.h"
+#include "DDImage/Thread.h"
 #include "EigenPCA-master/pca.cpp"
+#include <atomic>
 #include <cassert>
+#include <memory>
 
 class PCAGeo : public DD::Image::GeoOp
 {
@@ -28,28 +31,91 @@ public:
 
     void knobs(DD::Image::Knob_Callback f) override;
 
+    ~PCAGeo();
+
 protected:
     void _validate(bool for_real) override;
     
 private:
     int max_inputs_N;
-    int inputs_N;
-    unsigned int points_N;
-    unsigned int objs_N;
-    int mid_obj_id;
     int min_pca_N;
     bool pretty_show;
+    bool per_object;
+    bool async_solve;
+    int preview_mode;
+    float preview_fraction;
     float var_threshold;
     float d_x;
 
-    std::vector<float> PCAGeo::prepare_data() const;
+    // State of a single geometry_engine call. Keeping it off the node lets
+    // several frames or views cook the same PCAGeo concurrently.
+    struct CookContext {
+        std::vector<DD::Image::GeometryList> inputs;
+        int inputs_n;
+        unsigned int objs_n;
+        unsigned int points_n;
+        bool per_object;
+        bool preview;
+    };
+
+    struct ObjectSolveJob;
+    struct PcaModel;
+    struct SolveJob;
+    DD::Image::Lock model_lock;
+    std::shared_ptr<PcaModel> model;
+    unsigned int model_generation;
+    DD::Image::Lock solve_lock;
+    std::unique_ptr<SolveJob> solve_job;
+
+    std::vector<float> prepare_data(const CookContext& ctx) const;
+
+    std::vector<float> prepare_object_data(const CookContext& ctx, unsigned int obj_id) const;
+
+    void fetch_inputs(CookContext& ctx) const;
+
+    bool preview_active() const;
+
+    std::vector<unsigned int> sample_columns(const CookContext& ctx, int obj_id) const;
+
+    void geometry_engine_per_object(const CookContext& ctx, DD::Image::GeometryList& out);
+
+    static void solve_objects(unsigned index, unsigned threads_n, void* data);
+
+    DD::Image::Hash inputs_hash(const CookContext& ctx) const;
+
+    void geometry_engine_async(const CookContext& ctx, DD::Image::GeometryList& out);
+
+    void start_solve(const DD::Image::Hash& key, const CookContext& ctx);
+
+    static void run_solve(unsigned index, unsigned threads_n, void* data);
+
+    bool take_failed_solve(const DD::Image::Hash& key);
+
+    bool model_fits(const CookContext& ctx, PcaModel& solved) const;
+
+    void write_model(const CookContext& ctx,
+        std::vector<Pca>& pcas,
+        bool model_per_object,
+        DD::Image::GeometryList& out) const;
 
-    void process_extreme_points(Pca& pca, DD::Image::GeometryList& out, DD::Image::GeoInfo* info_to_copy);
+    int process_extreme_points(Pca& pca,
+        DD::Image::GeometryList& out,
+        const DD::Image::GeoInfo* info_to_copy,
+        unsigned int obj_points_n,
+        int first_out_id) const;
 
-    void write_neutral_model(std::vector<float>& mean, DD::Image::GeometryList& out, DD::Image::GeoInfo* info) const;
+    void write_neutral_model(std::vector<float>& mean,
+        DD::Image::GeometryList& out,
+        const DD::Image::GeoInfo* info,
+        unsigned int obj_points_n,
+        int out_id,
+        int mid_obj_id) const;
 
     void write_pca_models(std::vector<std::vector<float>>& pca_points,
         int pca_n, 
         DD::Image::GeometryList& out, 
-        DD::Image::GeoInfo* info) const;
+        const DD::Image::GeoInfo* info,
+        unsigned int obj_points_n,
+        int first_out_id,
+        int mid_obj_id) const;
 };
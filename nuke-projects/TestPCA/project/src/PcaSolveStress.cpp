@@ -0,0 +1,321 @@
+// Headless stress of the Pca paths PCAGeo relies on, built with
+// -DBUILD_PCA_STRESS=ON: inputs the solve has to reject, cancelling at
+// every poll, solving again after a cancel, a background solve that is
+// cancelled and restarted the way PCAGeo::start_solve does it, and cooks
+// running on several threads at once that have to match a serial run bit
+// for bit.
+// Usage: PcaSolveStress [points] [rows] [restarts] [threads]
+
+#include "EigenPCA-master/pca.cpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void check(bool ok, const char* what)
+    {
+        std::printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+        if (!ok)
+            failures++;
+    }
+
+    std::vector<float> random_data(unsigned int rows, unsigned int cols, unsigned int seed)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+        std::vector<float> data(rows * cols);
+        for (float& v : data)
+            v = value(random);
+        return data;
+    }
+
+    // every third column, as a preview would pick whole points
+    std::vector<unsigned int> every_third(unsigned int cols)
+    {
+        std::vector<unsigned int> sample;
+        for (unsigned int col = 0; col < cols; col += 3)
+            sample.push_back(col);
+        return sample;
+    }
+
+    bool same_variances(Pca& a, Pca& b)
+    {
+        const std::vector<float> va = a.pca_variance();
+        const std::vector<float> vb = b.pca_variance();
+        if (va.size() != vb.size())
+            return false;
+        for (size_t i = 0; i < va.size(); i++)
+        {
+            if (std::fabs(va[i] - vb[i]) > 1e-5f * std::max(1.0f, std::fabs(vb[i])))
+                return false;
+        }
+        return true;
+    }
+
+    bool descending(Pca& pca)
+    {
+        const std::vector<float> vars = pca.pca_variance();
+        return std::is_sorted(vars.rbegin(), vars.rend());
+    }
+
+    void error_paths()
+    {
+        Pca pca;
+        std::vector<float> empty;
+        check(pca.Calculate(empty, 4, 0) == -1, "an object without points is rejected");
+
+        std::vector<float> one_row = random_data(1, 30, 1);
+        check(pca.Calculate(one_row, 1, 30) == -1, "a single input is rejected");
+
+        std::vector<float> short_data = random_data(4, 30, 2);
+        check(pca.Calculate(short_data, 4, 31) == -1, "data of the wrong size is rejected");
+
+        std::vector<float> data = random_data(4, 30, 3);
+        const std::vector<unsigned int> outside = { 0, 30 };
+        check(pca.CalculateSampled(data, 4, 30, outside) == -1, "a sample column past the data is rejected");
+    }
+
+    // Rows that vary along one direction in the sampled columns and along
+    // another, much more, in the rest: the back-projected variances come
+    // out in the other order than the sampled ones.
+    void sampled_order(unsigned int cols)
+    {
+        const unsigned int rows = 4;
+        const float u1[rows] = { 1.0f, -1.0f, 0.0f, 0.0f };
+        const float u2[rows] = { 0.0f, 0.0f, 1.0f, -1.0f };
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+        std::vector<float> data(rows * cols);
+        for (unsigned int col = 0; col < cols; col++)
+        {
+            const bool sampled = col % 3 == 0;
+            const float a = value(random) * (sampled ? 1.0f : 0.1f);
+            const float b = value(random) * (sampled ? 0.5f : 5.0f);
+            for (unsigned int row = 0; row < rows; row++)
+                data[row * cols + col] = a * u1[row] + b * u2[row];
+        }
+
+        Pca pca;
+        check(pca.CalculateSampled(data, rows, cols, every_third(cols)) == 0, "sampled solve");
+        check(descending(pca), "sampled variances are sorted after the back-projection");
+    }
+
+    // Cancels at the n-th poll for every n until the solve gets through,
+    // solving again with the same Pca after each cancel.
+    void cancel_and_restart(unsigned int rows, unsigned int cols, bool sampled)
+    {
+        const std::vector<float> data = random_data(rows, cols, 4);
+        const std::vector<unsigned int> sample = sampled ? every_third(cols) : std::vector<unsigned int>();
+
+        Pca reference;
+        std::vector<float> copy = data;
+        const int reference_result = sampled ? reference.CalculateSampled(copy, rows, cols, sample)
+            : reference.Calculate(copy, rows, cols);
+        check(reference_result == 0, sampled ? "sampled reference solve" : "reference solve");
+        check(descending(reference), "variances are in descending order");
+
+        Pca pca;
+        bool restarts_match = true;
+        bool progress_ordered = true;
+        int cancels = 0;
+        for (int cancel_at = 0; ; cancel_at++)
+        {
+            int polls = 0;
+            float last_progress = 0.0f;
+            PcaControl control;
+            control.cancelled = [&polls, cancel_at]() { return polls++ == cancel_at; };
+            control.progress = [&last_progress, &progress_ordered](float fraction) {
+                progress_ordered = progress_ordered && fraction >= last_progress && fraction <= 1.0f;
+                last_progress = fraction;
+            };
+
+            copy = data;
+            const int result = sampled ? pca.CalculateSampled(copy, rows, cols, sample, control)
+                : pca.Calculate(copy, rows, cols, control);
+            if (result == -2)
+            {
+                cancels++;
+                continue;
+            }
+            restarts_match = result == 0 && same_variances(pca, reference);
+            break;
+        }
+        std::printf("      cancelled at %d polls before the solve got through\n", cancels);
+        check(cancels > 0, "the solve polls for cancellation");
+        check(progress_ordered, "progress only grows and stays within [0, 1]");
+        check(restarts_match, "a solve after cancels matches a fresh one");
+    }
+
+    // A solve thread cancelled after a random delay and started again, like
+    // PCAGeo replacing the job of inputs that changed.
+    void background_restarts(unsigned int rows, unsigned int cols, int restarts)
+    {
+        const std::vector<float> data = random_data(rows, cols, 5);
+        Pca reference;
+        std::vector<float> copy = data;
+        reference.Calculate(copy, rows, cols);
+
+        std::mt19937 random(6);
+        std::uniform_int_distribution<int> delay_us(0, 20000);
+        int cancelled_n = 0;
+        int finished_n = 0;
+        bool results_valid = true;
+        for (int restart = 0; restart < restarts; restart++)
+        {
+            std::atomic<bool> cancelled(false);
+            int result = -1;
+            Pca pca;
+            std::vector<float> job_data = data;
+            std::thread solve([&]() {
+                PcaControl control;
+                control.cancelled = [&cancelled]() { return cancelled.load(); };
+                result = pca.Calculate(job_data, rows, cols, control);
+            });
+            std::this_thread::sleep_for(std::chrono::microseconds(delay_us(random)));
+            cancelled = true;
+            solve.join();
+
+            if (result == -2)
+            {
+                cancelled_n++;
+            }
+            else
+            {
+                finished_n++;
+                results_valid = results_valid && result == 0 && same_variances(pca, reference);
+            }
+        }
+        std::printf("      %d restarts: %d cancelled, %d finished\n", restarts, cancelled_n, finished_n);
+        check(results_valid, "solves that finish before the cancel are complete");
+    }
+
+    // The inputs of one cook: rows of flattened xyz points, previewed
+    // through every third point or solved in full
+    struct Cook
+    {
+        unsigned int rows;
+        unsigned int cols;
+        std::vector<float> data;
+        std::vector<unsigned int> sample;
+    };
+
+    // What PCAGeo does per cook without the DDImage parts: solve on a copy
+    // of the inputs, keep the components the way process_extreme_points
+    // does (min_pca_N 1, variance threshold 0.2) and lay out the mean and
+    // the extreme points as the output objects. The result code comes
+    // first.
+    std::vector<float> run_cook(const Cook& cook)
+    {
+        std::vector<float> data = cook.data;
+        Pca pca;
+        const int result = cook.sample.empty() ? pca.Calculate(data, cook.rows, cook.cols)
+            : pca.CalculateSampled(data, cook.rows, cook.cols, cook.sample);
+        std::vector<float> out(1, float(result));
+        if (result != 0)
+            return out;
+
+        int pca_n = pca.pca_size().first;
+        int thresh_i = std::min(1, pca_n);
+        const std::vector<float> cum_props = pca.var_proportions();
+        for ( ; thresh_i < pca_n; thresh_i++)
+        {
+            if (cum_props[thresh_i] < 0.2f)
+                break;
+        }
+        pca_n = thresh_i;
+
+        const std::vector<float> mean = pca.mean();
+        out.insert(out.end(), mean.begin(), mean.end());
+        for (const std::vector<float>& obj : pca.calculate_extreme_points(pca_n))
+            out.insert(out.end(), obj.begin(), obj.end());
+        return out;
+    }
+
+    bool same_bits(const std::vector<float>& a, const std::vector<float>& b)
+    {
+        return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+    }
+
+    // threads_n cooks of different inputs, sizes and preview modes started
+    // together, several rounds, each compared with the same cook run alone
+    void parallel_cooks(unsigned int rows, unsigned int points_n, unsigned int threads_n, int rounds)
+    {
+        std::vector<Cook> cooks(threads_n);
+        for (unsigned int c = 0; c < threads_n; c++)
+        {
+            Cook& cook = cooks[c];
+            cook.rows = rows + c % 3;
+            cook.cols = 3 * (points_n / 2 + c * points_n / (2 * threads_n));
+            cook.data = random_data(cook.rows, cook.cols, 100 + c);
+            if (c % 2 == 1)
+                cook.sample = every_third(cook.cols);
+        }
+
+        std::vector<std::vector<float>> serial(threads_n);
+        for (unsigned int c = 0; c < threads_n; c++)
+            serial[c] = run_cook(cooks[c]);
+
+        bool all_solved = true;
+        for (const std::vector<float>& out : serial)
+            all_solved = all_solved && out[0] == 0.0f;
+        check(all_solved, "serial cooks solve");
+
+        int mismatches = 0;
+        for (int round = 0; round < rounds; round++)
+        {
+            std::vector<std::vector<float>> parallel(threads_n);
+            std::atomic<unsigned int> waiting(threads_n);
+            std::vector<std::thread> threads;
+            for (unsigned int c = 0; c < threads_n; c++)
+            {
+                threads.emplace_back([&, c]() {
+                    // start every cook at the same time
+                    waiting--;
+                    while (waiting > 0)
+                        std::this_thread::yield();
+                    parallel[c] = run_cook(cooks[(c + round) % threads_n]);
+                });
+            }
+            for (std::thread& thread : threads)
+                thread.join();
+
+            for (unsigned int c = 0; c < threads_n; c++)
+            {
+                if (!same_bits(parallel[c], serial[(c + round) % threads_n]))
+                    mismatches++;
+            }
+        }
+        std::printf("      %d rounds of %u cooks: %d differ from the serial run\n", rounds, threads_n, mismatches);
+        check(mismatches == 0, "parallel cooks match the serial run bit for bit");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned int points_n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+    const unsigned int rows = argc > 2 ? std::atoi(argv[2]) : 6;
+    const int restarts = argc > 3 ? std::atoi(argv[3]) : 50;
+    const unsigned int threads_n = argc > 4 ? std::max(2, std::atoi(argv[4]))
+        : std::max(2u, std::thread::hardware_concurrency());
+    const unsigned int cols = 3 * points_n;
+
+    error_paths();
+    cancel_and_restart(rows, cols, false);
+    cancel_and_restart(rows, cols, true);
+    sampled_order(cols);
+    background_restarts(rows, cols, restarts);
+    parallel_cooks(rows, points_n / 4, threads_n, 4);
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}